@@ -19,6 +19,128 @@
 #include <gst/gst.h>
 #include <glib.h>
 #include <gst/gstpad.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <glib/gstdio.h>
+
+#include <srt/srt.h>
+
+#ifdef G_OS_WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <avrt.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+/* Plain UDP, for the --loopback loss relay and the keyframe requests */
+#ifdef G_OS_WIN32
+typedef SOCKET UdpSocket;
+#define close_udp_socket closesocket
+#else
+typedef int UdpSocket;
+#define INVALID_SOCKET (-1)
+#define close_udp_socket close
+#endif
+
+#define CAPS_FEATURE_MEMORY_D3D11 "memory:D3D11Memory"
+
+/* srtsrc's own default for the 'latency' property, in milliseconds */
+#define DEFAULT_SRT_LATENCY 125
+
+/* Least SRT latency a --latency budget may leave, in milliseconds; below
+ * that there is no time for a single retransmission */
+#define MIN_SRT_LATENCY 20
+
+/* --low-latency defaults, in milliseconds */
+#define LOW_LATENCY_SRT_LATENCY 40
+#define LOW_LATENCY_QUEUE_TIME 40
+#define LOW_LATENCY_MAX_LATENESS 20
+
+/* Text carried on the X-GST payload type by the sender, followed by its
+ * wall-clock time in microseconds since the epoch */
+#define LATENCY_PROBE_PREFIX "latency-probe wallclock="
+#define LATENCY_MAX_SAMPLES 1000
+#define LATENCY_MAX_PENDING 64
+
+#define DEFAULT_METADATA_BUFFERS 64
+
+/* Per-output queue in --relay mode; a stalled output drops its own data */
+#define RELAY_QUEUE_TIME 1
+
+/* --bond remembers this many RTP sequence numbers to drop duplicates; older
+ * packets are left to the jitterbuffer */
+#define BOND_WINDOW 1024
+
+/* --multiview window size the tiles are laid out in */
+#define MULTIVIEW_WIDTH 1920
+#define MULTIVIEW_HEIGHT 1080
+
+/* --overload: a frame rendered this late, or this much queued in front of
+ * its decoder, counts as overloaded, in milliseconds. That many in a row
+ * step up a level, that many frames on time in a row step back down. */
+#define OVERLOAD_LATENESS 20
+#define OVERLOAD_QUEUE_TIME 200
+#define OVERLOAD_ESCALATE 10
+#define OVERLOAD_RECOVER 150
+
+/* --record defaults; the recording queue drops rather than stall playback */
+#define DEFAULT_SEGMENT_TIME 60
+#define RECORD_QUEUE_TIME 5
+#define RECORD_FILE_BUFFER (4 * 1024 * 1024)
+#define RECORD_FINALIZE_TIMEOUT 5
+
+/* 7-bit RTP payload type */
+#define RTP_PAYLOAD_TYPES 128
+
+/* Senders a stream keeps sequence state for at once, see
+ * _renumber_probe_cb() and bond_seen(); past that they are all forgotten
+ * and start over */
+#define RTP_SEQUENCE_MAX_SSRCS 16
+
+#define DEFAULT_VIDEO_SOURCE "videotestsrc is-live=true ! video/x-raw,width=1280,height=720,framerate=30/1"
+#define DEFAULT_BITRATE 4000
+#define DEFAULT_GOP 60
+#define LATENCY_PROBE_INTERVAL (200 * 1000)
+
+/* --feedback-port: datagram a receiver sends its sender for a new IDR, and
+ * how often one is asked for or honoured, in milliseconds */
+#define KEYFRAME_REQUEST "keyframe"
+#define KEYFRAME_REQUEST_INTERVAL 250
+
+/* Congestion reports from the receivers, in seconds, and what --abr makes
+ * of them: back off above ABR_LOSS_HIGH percent loss or on any packet that
+ * missed the latency budget, probe upwards below ABR_LOSS_LOW, and leave
+ * SRT a quarter of the measured bandwidth for retransmissions */
+#define FEEDBACK_REPORT_INTERVAL 1
+#define ABR_LOSS_HIGH 5.0
+#define ABR_LOSS_LOW 1.0
+#define ABR_DECREASE 0.75
+#define ABR_INCREASE_STEP 0.05
+#define ABR_HEADROOM 0.75
+#define ABR_MIN_BITRATE_DIVISOR 8
+
+/* --control: largest latency or queue time a command takes, in milliseconds */
+#define CONTROL_MAX_MS 60000
+
+/* --loopback receivers listen on LOOPBACK_PORT + n, the loss relays in
+ * front of them on LOOPBACK_RELAY_PORT + n */
+#define LOOPBACK_PORT 17000
+#define LOOPBACK_RELAY_PORT 18000
+
+/* Seconds between --trace-report summaries */
+#define TRACE_REPORT_INTERVAL 10
+
+/* --reconnect backoff, in milliseconds */
+#define RECONNECT_MIN_DELAY 50
+#define RECONNECT_MAX_DELAY 2000
 
  /**
   */
@@ -46,7 +168,12 @@
    *  +--------+     +-------+   |   |  (Video)  |     | Decoder |     | Sink  |
    *  | SRT    | --> | RTP   | --+   +-----------+     +---------+     +-------+
    *  | Source |     | Demux |   |
-   *  +--------+     +-------+   |   +-----------+                     +------+
+   *  +--------+     +-------+   |   +-----------+     +---------+     +-------+
+   *                             +-> | RTP Depay | --> | Audio   | --> | Audio |
+   *                             |   |  (Audio)  |     | Decoder |     | Sink  |
+   *                             |   +-----------+     +---------+     +-------+
+   *                             |
+   *                             |   +-----------+                     +------+
    *                             +-> | RTP Depay | ------------------> | App  |
    *                                 |   (Text)  |                     | Sink |
    *                                 +-----------+                     +------+
@@ -54,227 +181,6073 @@
 
 static struct
 {
-    const gchar* uri;
+    GPtrArray* uris;
     const gchar* user;
     const gchar* resource;
+    const gchar* decoder;
+    gint listen_port;
+
+    gint latency;
+    gint srt_latency;
+    gint jitter_latency;
+    gboolean drop_on_late;
+    gboolean low_latency;
+
+    const gchar* stats;
+    gint stats_interval;
+
+    gint metadata_buffers;
+    gboolean dump_metadata;
+
+    gboolean send;
+    const gchar* encoder;
+    const gchar* video_source;
+    gint bitrate;
+    gint gop;
+
+    gboolean reconnect;
+
+    gboolean decode_thread;
+    gboolean render_thread;
+    gboolean pin_threads;
+    gboolean mmcss;
+
+    gboolean instrument;
+    gboolean trace_report;
+
+    /* --bench: NULL, "decode" or "transport" */
+    const gchar* bench;
+    gint duration;
+
+    gint loopback;
+    gdouble loss;
+
+    const gchar* record;
+    const gchar* record_format;
+    gint segment_time;
+
+    gchar** relay;
+    gboolean bond;
+
+    gint feedback_port;
+    gboolean abr;
+
+    gint control_port;
+
+    gchar* overload;
+    gint overload_policy;
+
+    gboolean multiview;
+
+    gboolean fast_start;
+    gchar* registry;
+
+    /* --payload-type, indexed by payload type: a format name or caps */
+    gchar* payload_types[RTP_PAYLOAD_TYPES];
 } options;
 
+typedef struct
+{
+    /* Last video PTS seen when the probe arrived; it belongs to the next
+     * frame after that one */
+    GstClockTime after_pts;
+    gint64 wallclock;
+} LatencyProbe;
+
+typedef struct
+{
+    /* tee ! valve ! queue ! srtsink; queue and srtsink are started and
+     * restarted on their own, the valve shields the tee meanwhile */
+    GstElement* valve;
+    GstElement* queue;
+    GstElement* srtsink;
+    guint restart_source;
+
+    /* Set from the sync bus handler as soon as queue or srtsink posts an
+     * error, before its flow return can reach the tee */
+    gint failed;
+} RelayOutput;
+
+/* --overload levels, each dropping more in front of the decoder */
+typedef enum
+{
+    OVERLOAD_NONE,
+    OVERLOAD_DROP,
+    OVERLOAD_KEYFRAMES,
+    N_OVERLOAD_LEVELS
+} OverloadLevel;
+
+static const gchar* overload_levels[N_OVERLOAD_LEVELS] = {
+    "none", "drop", "keyframes"
+};
+
+/* One sender's sequence number space as rtpmux shares it between payload
+ * types, and the sequence number each depayloader is shown instead */
+typedef struct
+{
+    gint last_seq;
+    guint64 lost;
+
+    /* Indexed by payload type; 'lost' as of that type's previous packet */
+    gboolean started[RTP_PAYLOAD_TYPES];
+    guint16 next_seq[RTP_PAYLOAD_TYPES];
+    guint64 lost_at[RTP_PAYLOAD_TYPES];
+} RtpSequence;
+
+typedef struct
+{
+    /* One srtsrc of a --bond stream, locked, and started and restarted on
+     * its own */
+    GstElement* srtsrc;
+    guint restart_source;
+} BondPath;
+
+/* --bond: one sender's RTP sequence numbers seen lately, one bit each */
+typedef struct
+{
+    guint16 max_seq;
+    guint32 seen[BOND_WINDOW / 32];
+} BondWindow;
+
+typedef struct
+{
+    guint id;
+    gchar* uri;
+
+    /* srtsrc ! queue ! rtpptdemux, plus a sink bin per payload type, each
+     * with its own rtpjitterbuffer; with --relay srtsrc ! tee and a queue !
+     * srtsink per output instead. With --bond, 'srtsrc' is the funnel all
+     * 'paths' go into. */
+    GstElement* bin;
+    GstElement* srtsrc;
+    GstElement* rtpdemux;
+    GPtrArray* relays;
+    GPtrArray* paths;
+
+    /* --bond: SSRC -> BondWindow */
+    GMutex bond_lock;
+    GHashTable* bond_windows;
+    guint64 bond_duplicates;
+
+    /* Payload type -> sink bin, built before the first packet arrives */
+    GHashTable* sinkbins;
+
+    /* Only for streams accepted by the listener, where 'srtsrc' is an
+     * appsrc fed from the caller's socket */
+    gchar* streamid;
+    SRTSOCKET sock;
+
+    /* Glass-to-glass latency, shared by the video and metadata threads */
+    GMutex latency_lock;
+    GstClockTime last_video_pts;
+    GArray* pending_probes;
+    GArray* latency_samples;
+    guint next_latency_sample;
+
+    /* Metadata samples handed from the appsink thread to the main loop */
+    GMutex metadata_lock;
+    GstSample** metadata_ring;
+    guint metadata_head;
+    guint metadata_len;
+    guint64 metadata_dropped;
+    guint metadata_source;
+
+    /* --reconnect: only srtsrc is restarted, the sink bins stay up */
+    guint reconnect_source;
+    guint reconnect_delay;
+    guint reconnects;
+    gint reconnecting;
+
+    /* Packets with a payload type missing from the map, and ones too short
+     * for an RTP header */
+    gint unknown_pt_dropped;
+    gint short_dropped;
+
+    /* SSRC -> RtpSequence, only touched by the rtpptdemux thread */
+    GHashTable* sequences;
+
+    /* --feedback-port: the sender's address, and time-to-first-frame */
+    GMutex feedback_lock;
+    struct sockaddr_in feedback_addr;
+    gboolean has_feedback_addr;
+    gint64 last_keyframe_request;
+    guint keyframe_requests;
+    gint64 joined;
+    gint waiting_for_keyframe;
+
+    /* --overload state, from the video streaming threads, and the video
+     * sinks' own QoS drops as posted on the bus */
+    GMutex overload_lock;
+    gint overload_level;
+    guint overload_late;
+    guint overload_fine;
+    gboolean overload_resync;
+    gint qos_late;
+    guint64 overload_dropped;
+    guint64 qos_dropped;
+
+    /* SRT totals at the last congestion report */
+    gint64 reported_packets;
+    gint64 reported_lost;
+    gint64 reported_dropped;
+
+    /* --bench counters, from the video branch and every streaming thread */
+    GMutex bench_lock;
+    guint64 bench_frames;
+    guint64 bench_bytes;
+    guint64 bench_lost;
+    gint64 bench_first_frame;
+    gint64 bench_last_frame;
+    GHashTable* bench_thread_cpu;
+} Stream;
+
+typedef enum
+{
+    VIDEO_CODEC_H264,
+    VIDEO_CODEC_H265,
+    VIDEO_CODEC_AV1,
+    N_VIDEO_CODECS
+} VideoCodec;
+
+typedef struct
+{
+    const gchar* encoding;
+    const gchar* depay;
+    const gchar* parse;
+} VideoCodecInfo;
+
+static const VideoCodecInfo video_codecs[N_VIDEO_CODECS] = {
+    {"H264", "rtph264depay", "h264parse"},
+    {"H265", "rtph265depay", "h265parse"},
+    {"AV1", "rtpav1depay", "av1parse"},
+};
+
+typedef struct
+{
+    const gchar* decoder;
+    const gchar* sink;
+    const gchar* caps;
+} VideoBranch;
+
+typedef enum
+{
+    AUDIO_CODEC_OPUS,
+    AUDIO_CODEC_AAC,
+    N_AUDIO_CODECS
+} AudioCodec;
+
+typedef struct
+{
+    const gchar* encoding;
+    const gchar* depay;
+    /* Parser and decoder, tried before falling back to decodebin */
+    const gchar* decoder;
+    const gchar* factory;
+} AudioCodecInfo;
+
+static const AudioCodecInfo audio_codecs[N_AUDIO_CODECS] = {
+    {"OPUS", "rtpopusdepay", "opusdec", "opusdec"},
+    {"MP4A-LATM", "rtpmp4adepay", "aacparse ! avdec_aac", "avdec_aac"},
+};
+
 static struct
 {
     GstElement* pipeline;
     GMainLoop* loop;
+
+    GPtrArray* streams;
+    guint next_stream_id;
+
+    /* Decoder and sink per video codec, see select_video_decoder() */
+    VideoBranch video[N_VIDEO_CODECS];
+    const gchar* audio_sink;
+
+    /* Receive latency budget, in milliseconds */
+    gint srt_latency;
+    gint jitter_latency;
+    gchar* jitterbuffer;
+
+    /* Every queue in the receive path */
+    gchar* queue;
+
+    /* Optional thread boundaries in front of decoders and sinks, "" if off */
+    gchar* decode_queue;
+    gchar* render_queue;
+    gint next_cpu;
+
+    /* --instrument: ElementStats for every element in the receive path */
+    GMutex instruments_lock;
+    GPtrArray* instruments;
+
+    /* Payload type -> caps, parsed once; NULL for PTs that get dropped */
+    GstCaps* pt_caps[RTP_PAYLOAD_TYPES];
+
+    /* Keyframe requests go out on this one, INVALID_SOCKET without
+     * --feedback-port */
+    UdpSocket feedback;
+
+    /* --control, INVALID_SOCKET without it */
+    UdpSocket control;
+
+    /* --multiview: every video sink bin feeds a pad of this one */
+    GstElement* compositor;
+
+    /* --record: recorders still finalizing, see finalize_recordings() */
+    GMutex record_lock;
+    GCond record_cond;
+    guint record_pending;
+
+    FILE* stats;
 } app;
 
+typedef struct
+{
+    const gchar* name;
+    /* Indexed by VideoCodec */
+    const gchar* decoders[N_VIDEO_CODECS];
+    /* NULL presents on whatever display_video_sink() finds */
+    const gchar* sink;
+    /* Pinned between the decoder and the sink, NULL to let them negotiate */
+    const gchar* caps;
+    gboolean hardware;
+} VideoDecoder;
+
+/* Hardware decoders come first, in the order 'auto' tries them. Each codec
+ * is looked up on its own, so a GPU without an AV1 decoder still gets
+ * hardware H264 and H265.
+ *
+ * On Windows they all output D3D11 memory, so d3d11videosink can present
+ * without a download. On Linux the VA decoders hand DMABuf to waylandsink
+ * and kmssink on their own; the newer va plugin is preferred over
+ * gstreamer-vaapi when both are installed. */
+/* *INDENT-OFF* */
+static const VideoDecoder video_decoders[] = {
+#ifdef G_OS_WIN32
+    {"d3d11", {"d3d11h264dec", "d3d11h265dec", "d3d11av1dec"},
+        "d3d11videosink", "video/x-raw(" CAPS_FEATURE_MEMORY_D3D11 ")", TRUE},
+    {"nvcodec", {"nvh264dec", "nvh265dec", "nvav1dec"},
+        "d3d11videosink", "video/x-raw(" CAPS_FEATURE_MEMORY_D3D11 ")", TRUE},
+    {"qsv", {"qsvh264dec", "qsvh265dec", "qsvav1dec"},
+        "d3d11videosink", "video/x-raw(" CAPS_FEATURE_MEMORY_D3D11 ")", TRUE},
+#else
+    {"vaapi", {"vah264dec", "vah265dec", "vaav1dec"}, NULL, NULL, TRUE},
+    {"vaapi", {"vaapih264dec", "vaapih265dec", "vaapiav1dec"}, NULL, NULL,
+        TRUE},
+    {"nvcodec", {"nvh264dec", "nvh265dec", "nvav1dec"}, NULL, NULL, TRUE},
+#endif
+    {"sw", {"avdec_h264", "avdec_h265", "dav1ddec"}, NULL, NULL, FALSE},
+};
+/* *INDENT-ON* */
+
+#ifdef G_OS_WIN32
+#define VIDEO_DECODER_NAMES "auto, d3d11, nvcodec, qsv, sw"
+#else
+#define VIDEO_DECODER_NAMES "auto, vaapi, nvcodec, sw"
+#endif
+
+typedef struct
+{
+    const gchar* name;
+    const gchar* encoder;
+    /* Low-latency settings as property/value pairs */
+    const gchar* settings[10];
+    gboolean hardware;
+} VideoEncoder;
+
+/* Same order as for decoders, with x264enc as the last resort. Settings an
+ * element version does not know are skipped. */
+/* *INDENT-OFF* */
+static const VideoEncoder video_encoders[] = {
+    {"nvcodec", "nvh264enc",
+        {"preset", "low-latency-hq", "zerolatency", "true", "rc-mode", "cbr",
+         "bframes", "0", NULL}, TRUE},
+    {"qsv", "qsvh264enc",
+        {"low-latency", "true", "target-usage", "7", "rate-control", "cbr",
+         "b-frames", "0", NULL}, TRUE},
+    {"mf", "mfh264enc",
+        {"low-latency", "true", "rc-mode", "cbr", "bframes", "0", NULL}, TRUE},
+    {"x264", "x264enc",
+        {"tune", "zerolatency", "speed-preset", "ultrafast", "bframes", "0",
+         NULL}, FALSE},
+};
+/* *INDENT-ON* */
+
+typedef struct
+{
+    const gchar* name;
+    const gchar* caps;
+} PayloadFormat;
+
+/* Formats --payload-type accepts by name */
+/* *INDENT-OFF* */
+static const PayloadFormat payload_formats[] = {
+    {"h264", "application/x-rtp, media=(string)video, encoding-name=(string)H264, clock-rate=(int)90000"},
+    {"h265", "application/x-rtp, media=(string)video, encoding-name=(string)H265, clock-rate=(int)90000"},
+    {"av1", "application/x-rtp, media=(string)video, encoding-name=(string)AV1, clock-rate=(int)90000"},
+    {"opus", "application/x-rtp, media=(string)audio, encoding-name=(string)OPUS, clock-rate=(int)48000"},
+    {"aac", "application/x-rtp, media=(string)audio, encoding-name=(string)MP4A-LATM, clock-rate=(int)48000, cpresent=(string)1"},
+    {"klv", "application/x-rtp, media=(string)application, encoding-name=(string)SMPTE336M, clock-rate=(int)90000"},
+    {"x-gst", "application/x-rtp, media=(string)application, encoding-name=(string)X-GST, clock-rate=(int)90000"},
+};
+/* *INDENT-ON* */
+
+static gboolean
+_parse_rest_arg_cb(const gchar* option_name, const gchar* value,
+    gpointer data, GError** error)
+{
+    if (!g_str_has_prefix(value, "srt://")) {
+        g_printerr("Invalid SRT uri: %s\n", value);
+        return FALSE;
+    }
+
+    if (options.uris == NULL)
+        options.uris = g_ptr_array_new_with_free_func(g_free);
+
+    g_ptr_array_add(options.uris, g_strdup(value));
+
+    return TRUE;
+}
+
+static gboolean
+_parse_payload_type_arg_cb(const gchar* option_name, const gchar* value,
+    gpointer data, GError** error)
+{
+    const gchar* format = strchr(value, '=');
+    gchar* end = NULL;
+    guint64 pt;
+
+    pt = g_ascii_strtoull(value, &end, 10);
+
+    if (format == NULL || end != format || end == value
+        || pt >= RTP_PAYLOAD_TYPES || format[1] == '\0') {
+        g_printerr("Invalid payload type mapping: %s\n", value);
+        return FALSE;
+    }
+
+    g_free(options.payload_types[pt]);
+    options.payload_types[pt] = g_strdup(format + 1);
+
+    return TRUE;
+}
+
+static gboolean
+_parse_decoder_arg_cb(const gchar* option_name, const gchar* value,
+    gpointer data, GError** error)
+{
+    guint i;
+
+    if (g_strcmp0(value, "auto") == 0) {
+        options.decoder = NULL;
+        return TRUE;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(video_decoders); i++) {
+        if (g_strcmp0(value, video_decoders[i].name) == 0) {
+            options.decoder = video_decoders[i].name;
+            return TRUE;
+        }
+    }
+
+    g_printerr("Invalid decoder: %s\n", value);
+
+    return FALSE;
+}
+
+static gboolean
+_parse_encoder_arg_cb(const gchar* option_name, const gchar* value,
+    gpointer data, GError** error)
+{
+    guint i;
+
+    if (g_strcmp0(value, "auto") == 0) {
+        options.encoder = NULL;
+        return TRUE;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(video_encoders); i++) {
+        if (g_strcmp0(value, video_encoders[i].name) == 0) {
+            options.encoder = video_encoders[i].name;
+            return TRUE;
+        }
+    }
+
+    g_printerr("Invalid encoder: %s\n", value);
+
+    return FALSE;
+}
+
+static gboolean
+element_available(const gchar* name)
+{
+    g_autoptr(GstElementFactory) factory = gst_element_factory_find(name);
+
+    return factory != NULL;
+}
+
+static const gchar*
+display_video_sink(void)
+{
+#ifdef G_OS_WIN32
+    if (element_available("d3d11videosink"))
+        return "d3d11videosink";
+
+    return "autovideosink";
+#else
+    if (g_getenv("WAYLAND_DISPLAY") != NULL && element_available("waylandsink"))
+        return "waylandsink";
+
+    if (g_getenv("DISPLAY") != NULL || g_getenv("WAYLAND_DISPLAY") != NULL)
+        return "autovideosink";
+
+    /* No compositor to talk to: a console with a monitor gets kmssink, a
+     * headless ingest node only records, relays and reports */
+    if (g_file_test("/dev/dri/card0", G_FILE_TEST_EXISTS)
+        && element_available("kmssink"))
+        return "kmssink";
+
+    return "fakesink";
+#endif
+}
+
+static void
+select_video_decoder(const gchar* name, VideoCodec codec)
+{
+    VideoBranch* branch = &app.video[codec];
+    guint i;
+
+    /* decodebin picks whatever has the highest rank, which is the last resort.
+     * Keep the platform's own sink behind it as well, so a hardware decoder
+     * that decodebin happens to plug can still hand over GPU memory. */
+    branch->decoder = "decodebin";
+    branch->sink = display_video_sink();
+    branch->caps = NULL;
+
+    for (i = 0; i < G_N_ELEMENTS(video_decoders); i++) {
+        const VideoDecoder* entry = &video_decoders[i];
+        const gchar* decoder = entry->decoders[codec];
+
+        if (name == NULL && !entry->hardware)
+            continue;
+
+        if (name != NULL && g_strcmp0(name, entry->name) != 0)
+            continue;
+
+        /* A second entry under the same name may still have one */
+        if (!element_available(decoder))
+            continue;
+
+        branch->decoder = decoder;
+
+        /* Keep frames on the GPU from the decoder to the sink */
+        if (entry->sink != NULL && element_available(entry->sink)) {
+            branch->sink = entry->sink;
+            branch->caps = entry->caps;
+        }
+        break;
+    }
+
+    if (name != NULL && i == G_N_ELEMENTS(video_decoders))
+        g_printerr("No %s decoder for %s, falling back to decodebin\n", name,
+            video_codecs[codec].encoding);
+
+    /* --multiview decodes into the compositor instead, and only
+     * d3d11compositor takes the GPU memory those caps pin, see
+     * add_multiview() */
+    if (options.multiview && !element_available("d3d11compositor"))
+        branch->caps = NULL;
+
+    g_print("%s decoder: %s, sink: %s%s%s%s\n", video_codecs[codec].encoding,
+        branch->decoder, branch->sink,
+        branch->caps != NULL ? " (" : "",
+        branch->caps != NULL ? branch->caps : "",
+        branch->caps != NULL ? ")" : "");
+}
+
+static void
+select_audio_sink(void)
+{
+    /* low-latency picks the smallest device period wasapisink can get;
+     * --low-latency also switches it to exclusive mode */
+    if (element_available("wasapisink"))
+        app.audio_sink = "wasapisink low-latency=true";
+    else
+        app.audio_sink = "autoaudiosink";
+
+    g_print("audio sink: %s\n", app.audio_sink);
+}
+
+static gboolean
+parse_streamid(const gchar* streamid, gchar** u, gchar** r)
+{
+    g_auto(GStrv) tags = NULL;
+    guint i;
+
+    if (streamid == NULL || !g_str_has_prefix(streamid, "#!::"))
+        return FALSE;
+
+    tags = g_strsplit(streamid + strlen("#!::"), ",", -1);
+
+    for (i = 0; tags[i] != NULL; i++) {
+        if (g_str_has_prefix(tags[i], "u=") && *u == NULL)
+            *u = g_strdup(tags[i] + 2);
+        else if (g_str_has_prefix(tags[i], "r=") && *r == NULL)
+            *r = g_strdup(tags[i] + 2);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+configure_payload_types(GError** error)
+{
+    guint pt, i;
+
+    if (options.payload_types[96] == NULL)
+        options.payload_types[96] = g_strdup("h264");
+    if (options.payload_types[99] == NULL)
+        options.payload_types[99] = g_strdup("x-gst");
+
+    for (pt = 0; pt < RTP_PAYLOAD_TYPES; pt++) {
+        const gchar* format = options.payload_types[pt];
+        GstCaps* caps = NULL;
+
+        if (format == NULL || g_strcmp0(format, "none") == 0)
+            continue;
+
+        for (i = 0; i < G_N_ELEMENTS(payload_formats); i++) {
+            if (g_ascii_strcasecmp(format, payload_formats[i].name) == 0) {
+                format = payload_formats[i].caps;
+                break;
+            }
+        }
+
+        caps = gst_caps_from_string(format);
+
+        if (caps == NULL || gst_caps_get_size(caps) != 1) {
+            g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "Invalid caps for payload type %u: %s", pt, format);
+            if (caps != NULL)
+                gst_caps_unref(caps);
+            return FALSE;
+        }
+
+        gst_caps_set_simple(caps, "payload", G_TYPE_INT, (gint) pt, NULL);
+        app.pt_caps[pt] = caps;
+    }
+
+    return TRUE;
+}
+
+static const gchar*
+get_encoding_name(guint pt)
+{
+    const GstStructure* s = gst_caps_get_structure(app.pt_caps[pt], 0);
+
+    return gst_structure_get_string(s, "encoding-name");
+}
+
+static gint
+get_video_codec(guint pt)
+{
+    const gchar* encoding = get_encoding_name(pt);
+    gint codec;
+
+    for (codec = 0; codec < N_VIDEO_CODECS; codec++) {
+        if (g_strcmp0(encoding, video_codecs[codec].encoding) == 0)
+            return codec;
+    }
+
+    return -1;
+}
+
+static gint
+get_audio_codec(guint pt)
+{
+    const gchar* encoding = get_encoding_name(pt);
+    gint codec;
+
+    for (codec = 0; codec < N_AUDIO_CODECS; codec++) {
+        if (g_strcmp0(encoding, audio_codecs[codec].encoding) == 0)
+            return codec;
+    }
+
+    return -1;
+}
+
+static void
+select_decoders(const gchar* name)
+{
+    gboolean selected[N_VIDEO_CODECS] = { FALSE };
+    gboolean audio = FALSE;
+    guint pt;
+
+    /* Only for codecs the payload type map actually uses */
+    for (pt = 0; pt < RTP_PAYLOAD_TYPES; pt++) {
+        gint codec;
+
+        if (app.pt_caps[pt] == NULL)
+            continue;
+
+        if (!audio && get_audio_codec(pt) >= 0) {
+            select_audio_sink();
+            audio = TRUE;
+        }
+
+        codec = get_video_codec(pt);
+        if (codec < 0 || selected[codec])
+            continue;
+
+        select_video_decoder(name, (VideoCodec) codec);
+        selected[codec] = TRUE;
+    }
+}
+
+static void
+update_jitterbuffer_description(void)
+{
+    g_free(app.jitterbuffer);
+
+    /* One per payload type, behind rtpptdemux: video and audio run at
+     * different clock rates, and rtpjitterbuffer resets its timing on every
+     * change of rate. rtpmux numbers all payload types in one sequence, so
+     * this relies on _renumber_probe_cb() giving each its own. */
+    if (app.jitter_latency > 0)
+        app.jitterbuffer =
+            g_strdup_printf("rtpjitterbuffer name=jitterbuffer latency=%d drop-on-latency=%s ! ",
+                app.jitter_latency, options.drop_on_late ? "true" : "false");
+    else
+        app.jitterbuffer = g_strdup("");
+}
+
+static void
+update_queue_description(guint64 time)
+{
+    g_free(app.queue);
+    g_free(app.decode_queue);
+    g_free(app.render_queue);
+
+    /* 0 keeps queue's own limits; in low-latency mode a stalled consumer
+     * drops the oldest data instead of piling up delay. */
+    if (time > 0)
+        app.queue =
+            g_strdup_printf
+            ("queue max-size-buffers=0 max-size-bytes=0 max-size-time=%"
+                G_GUINT64_FORMAT "%s", time,
+                options.low_latency ? " leaky=downstream" : "");
+    else
+        app.queue = g_strdup("queue");
+
+    /* Same queue settings, named so streaming threads can tell their role */
+    app.decode_queue = options.decode_thread ?
+        g_strdup_printf("%s name=decodeq ! ", app.queue) : g_strdup("");
+    app.render_queue = options.render_thread ?
+        g_strdup_printf("%s name=renderq ! ", app.queue) : g_strdup("");
+}
+
+static gboolean
+configure_latency(GError** error)
+{
+    gint default_srt_latency =
+        options.low_latency ? LOW_LATENCY_SRT_LATENCY : DEFAULT_SRT_LATENCY;
+    gint srt_latency = options.srt_latency;
+    gint jitter_latency = options.jitter_latency;
+
+    /* Negative when not given; 0 is a value of its own */
+    if (options.latency > 0) {
+        if (srt_latency >= 0 && jitter_latency >= 0) {
+            g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "--latency can not be combined with both --srt-latency and --jitter-latency");
+            return FALSE;
+        }
+
+        /* Whatever is not given explicitly gets the rest of the budget */
+        if (jitter_latency >= 0) {
+            srt_latency = options.latency - jitter_latency;
+
+            if (srt_latency < MIN_SRT_LATENCY) {
+                g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                    "Latency budget of %d ms leaves SRT less than %d ms",
+                    options.latency, MIN_SRT_LATENCY);
+                return FALSE;
+            }
+        }
+        else {
+            jitter_latency = options.latency -
+                (srt_latency >= 0 ? srt_latency : default_srt_latency);
+        }
+
+        if (jitter_latency < 0) {
+            g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "Latency budget of %d ms is too small", options.latency);
+            return FALSE;
+        }
+    }
+
+    app.srt_latency = srt_latency >= 0 ? srt_latency : default_srt_latency;
+    app.jitter_latency = MAX(jitter_latency, 0);
+
+    update_jitterbuffer_description();
+
+    /* The default queue holds up to a second */
+    update_queue_description(options.low_latency ?
+        (guint64) LOW_LATENCY_QUEUE_TIME * GST_MSECOND : 0);
+
+    /* SRT negotiates the larger of both peers' latencies, so this is a
+     * lower bound when the sender asks for more. */
+    g_print("latency budget: srt %d ms + jitterbuffer %d ms = %d ms\n",
+        app.srt_latency, app.jitter_latency,
+        app.srt_latency + app.jitter_latency);
+
+    return TRUE;
+}
+
+static gchar*
+build_streamid(const gchar* u, const gchar* r)
+{
+    g_autofree gchar* streamid = NULL;
+
+    g_autofree gchar* u_tag = NULL;
+    g_autofree gchar* r_tag = NULL;
+
+    if (u != NULL)
+        u_tag = g_strdup_printf("u=%s", u);
+    if (r != NULL)
+        r_tag = g_strdup_printf("r=%s", r);
+
+    if (u || r) {
+
+        /* *INDENT-OFF* */
+        streamid = g_strconcat("#!::",
+            u_tag != NULL ? u_tag : "",
+            u && r ? "," : "",
+            r_tag != NULL ? r_tag : "",
+            NULL);
+        /* *INDENT-ON* */
+
+    }
+
+    return (gchar *) g_steal_pointer(&streamid);
+}
+
+static void
+_sinkbin_free(gpointer data)
+{
+    GstElement* sinkbin = GST_ELEMENT(data);
+
+    /* Bins that never got linked are still in READY */
+    gst_element_set_state(sinkbin, GST_STATE_NULL);
+    gst_object_unref(sinkbin);
+}
+
+static void
+stream_free(Stream* stream)
+{
+    guint i;
+
+    g_hash_table_unref(stream->sinkbins);
+    g_hash_table_unref(stream->sequences);
+
+    if (stream->reconnect_source != 0)
+        g_source_remove(stream->reconnect_source);
+
+    if (stream->metadata_source != 0)
+        g_source_remove(stream->metadata_source);
+
+    for (i = 0; i < stream->metadata_len; i++)
+        gst_sample_unref(stream->metadata_ring[(stream->metadata_head + i) %
+                options.metadata_buffers]);
+    g_free(stream->metadata_ring);
+    g_mutex_clear(&stream->metadata_lock);
+
+    g_hash_table_unref(stream->bench_thread_cpu);
+    g_mutex_clear(&stream->bench_lock);
+    g_mutex_clear(&stream->feedback_lock);
+    g_mutex_clear(&stream->overload_lock);
+
+    if (stream->rtpdemux != NULL)
+        gst_object_unref(stream->rtpdemux);
+    g_ptr_array_unref(stream->relays);
+    g_ptr_array_unref(stream->paths);
+    g_hash_table_unref(stream->bond_windows);
+    g_mutex_clear(&stream->bond_lock);
+    gst_object_unref(stream->srtsrc);
+    gst_object_unref(stream->bin);
+    g_array_unref(stream->pending_probes);
+    g_array_unref(stream->latency_samples);
+    g_mutex_clear(&stream->latency_lock);
+    g_free(stream->streamid);
+    g_free(stream->uri);
+    g_free(stream);
+}
+
+static void listener_detach(Stream* stream);
+static void finalize_recordings(Stream* stream);
+static void release_multiview_tiles(Stream* stream);
+static RelayOutput* find_relay_output(Stream* stream, GstObject* object);
+static void schedule_relay_restart(RelayOutput* output);
+static BondPath* find_bond_path(Stream* stream, GstObject* object);
+static void schedule_path_restart(Stream* stream, BondPath* path);
+static void start_bond_paths(Stream* stream);
+
+static Stream*
+find_stream(GstObject* object)
+{
+    guint i;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+
+        if (object == GST_OBJECT(stream->bin)
+            || gst_object_has_as_ancestor(object, GST_OBJECT(stream->bin)))
+            return stream;
+    }
+
+    return NULL;
+}
+
+static void
+remove_stream(Stream* stream)
+{
+    if (stream->sock != SRT_INVALID_SOCK)
+        listener_detach(stream);
+
+    finalize_recordings(stream);
+    gst_element_set_state(stream->bin, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(app.pipeline), stream->bin);
+
+    if (app.compositor != NULL)
+        release_multiview_tiles(stream);
+
+    g_ptr_array_remove(app.streams, stream);
+}
+
+/**
+ * Section: Feedback
+ *
+ * With --feedback-port, receivers talk back to their sender over UDP, one
+ * serialized GstStructure per datagram: a "keyframe" request, or once every
+ * FEEDBACK_REPORT_INTERVAL a "congestion" report with what SRT lost, dropped
+ * and measured since the last one, which --abr on the sender turns into an
+ * encoder bitrate.
+ *
+ * The video depayloaders wait for a keyframe, so whatever arrives before the
+ * first IDR after joining or after loss is dropped before it costs a parse or
+ * a decode. To keep that wait short, a receiver with --feedback-port asks its
+ * sender for a new IDR over UDP: when a video payload type shows up, when a
+ * connection comes back, and whenever the depayloader or decoder sends a
+ * force-key-unit event upstream after packet loss. The sender forces one on
+ * its encoder, see feedback_thread_func().
+ */
+
+static gboolean
+resolve_feedback_addr(Stream* stream, struct sockaddr_in* addr)
+{
+    g_autoptr(GstUri) uri = NULL;
+    const gchar* host = NULL;
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+
+    memset(addr, 0, sizeof(*addr));
+
+    /* Accepted by the listener: wherever the caller connected from */
+    if (stream->sock != SRT_INVALID_SOCK) {
+        struct sockaddr_storage peer;
+        int len = sizeof(peer);
+
+        if (srt_getpeername(stream->sock, (struct sockaddr *) &peer,
+                &len) == SRT_ERROR || peer.ss_family != AF_INET)
+            return FALSE;
+
+        memcpy(addr, &peer, sizeof(*addr));
+        return TRUE;
+    }
+
+    uri = gst_uri_from_string(stream->uri);
+    if (uri != NULL)
+        host = gst_uri_get_host(uri);
+
+    /* srtsrc doesn't say who called in; the --loopback senders are local */
+    if (host == NULL || *host == '\0') {
+        if (options.loopback == 0)
+            return FALSE;
+
+        addr->sin_family = AF_INET;
+        addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return TRUE;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if (getaddrinfo(host, NULL, &hints, &result) != 0)
+        return FALSE;
+
+    memcpy(addr, result->ai_addr, sizeof(*addr));
+    freeaddrinfo(result);
+
+    return TRUE;
+}
+
+static void
+configure_feedback(Stream* stream)
+{
+    struct sockaddr_in addr;
+
+    if (app.feedback == INVALID_SOCKET)
+        return;
+
+    if (!resolve_feedback_addr(stream, &addr)) {
+        g_print("stream %u: sender address unknown, no keyframe requests\n",
+            stream->id);
+        return;
+    }
+
+    /* The --loopback senders take theirs one port apart */
+    addr.sin_port = htons(options.feedback_port +
+        (options.loopback > 0 ? stream->id : 0));
+
+    g_mutex_lock(&stream->feedback_lock);
+    stream->feedback_addr = addr;
+    stream->has_feedback_addr = TRUE;
+    g_mutex_unlock(&stream->feedback_lock);
+}
+
+static void
+send_feedback(const struct sockaddr_in* addr, const gchar* text)
+{
+    sendto(app.feedback, text, strlen(text), 0, (const struct sockaddr *) addr,
+        sizeof(*addr));
+}
+
+static void
+request_keyframe(Stream* stream, const gchar* reason)
+{
+    gint64 now = g_get_monotonic_time();
+    struct sockaddr_in addr;
+    gboolean send = FALSE;
+
+    g_mutex_lock(&stream->feedback_lock);
+    if (stream->has_feedback_addr && now - stream->last_keyframe_request >=
+        KEYFRAME_REQUEST_INTERVAL * 1000) {
+        stream->last_keyframe_request = now;
+        stream->keyframe_requests++;
+        addr = stream->feedback_addr;
+        send = TRUE;
+    }
+    g_mutex_unlock(&stream->feedback_lock);
+
+    if (!send)
+        return;
+
+    g_print("stream %u: requesting a keyframe (%s)\n", stream->id, reason);
+    send_feedback(&addr, KEYFRAME_REQUEST);
+}
+
+static void
+wait_for_keyframe(Stream* stream, const gchar* reason)
+{
+    g_mutex_lock(&stream->feedback_lock);
+    stream->joined = g_get_monotonic_time();
+    g_mutex_unlock(&stream->feedback_lock);
+
+    g_atomic_int_set(&stream->waiting_for_keyframe, 1);
+
+    request_keyframe(stream, reason);
+}
+
+static void
+check_first_keyframe(Stream* stream)
+{
+    gint64 joined;
+
+    if (!g_atomic_int_compare_and_exchange(&stream->waiting_for_keyframe, 1, 0))
+        return;
+
+    g_mutex_lock(&stream->feedback_lock);
+    joined = stream->joined;
+    g_mutex_unlock(&stream->feedback_lock);
+
+    /* The depayloader lets nothing but a keyframe through first */
+    g_print("stream %u: first keyframe after %.0f ms\n", stream->id,
+        (g_get_monotonic_time() - joined) / 1000.0);
+}
+
+static GstPadProbeReturn
+_force_key_unit_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+
+    /* What gst_video_event_new_upstream_force_key_unit() sends */
+    if (!gst_event_has_name(GST_PAD_PROBE_INFO_EVENT(info), "GstForceKeyUnit"))
+        return GST_PAD_PROBE_OK;
+
+    request_keyframe(stream, "packet loss");
+
+    /* Nothing between here and srtsrc can act on it */
+    return GST_PAD_PROBE_DROP;
+}
+
+/**
+ * Section: Startup
+ *
+ * Restart-to-first-frame is mostly gst_init() checking every installed
+ * plugin against the registry, and then the pipeline loading the ones it
+ * uses. --fast-start keeps a registry cache of its own (--registry) and,
+ * once that file exists, skips the check, so nothing is loaded that the
+ * pipeline does not ask for. Those plugins are then loaded up front from
+ * the payload type map, which also turns a missing decoder into a warning
+ * before anything is built. Delete the cache after installing or removing
+ * plugins.
+ *
+ * Each phase is timed from the start of main() and the lot is printed once
+ * the first video frame reaches a sink. The connect and first frame marks
+ * come from streaming threads and are posted to the bus like everything
+ * else.
+ */
+
+typedef enum
+{
+    STARTUP_INIT,
+    STARTUP_PRELOAD,
+    STARTUP_BUILD,
+    STARTUP_CONNECT,
+    STARTUP_FIRST_FRAME,
+    N_STARTUP_PHASES
+} StartupPhase;
+
+static const gchar* startup_phases[N_STARTUP_PHASES] = {
+    "init", "preload", "build", "connect", "first frame",
+};
+
+static struct
+{
+    gint64 start;
+    /* Monotonic time each phase ended at, 0 for phases that didn't run */
+    gint64 ends[N_STARTUP_PHASES];
+} startup;
+
+static void
+print_startup_report(void)
+{
+    g_autoptr(GString) report = g_string_new("startup:");
+    gint64 last = startup.start;
+    guint i;
+
+    for (i = 0; i < N_STARTUP_PHASES; i++) {
+        if (startup.ends[i] == 0)
+            continue;
+
+        g_string_append_printf(report, " %s %.1f ms,", startup_phases[i],
+            (startup.ends[i] - last) / 1000.0);
+        last = startup.ends[i];
+    }
+
+    g_string_append_printf(report, " total %.1f ms",
+        (last - startup.start) / 1000.0);
+
+    g_print("%s\n", report->str);
+}
+
+static void
+mark_startup(StartupPhase phase, gint64 now)
+{
+    /* Only the first stream to get there counts */
+    if (startup.ends[phase] != 0)
+        return;
+
+    startup.ends[phase] = now;
+
+    if (phase == STARTUP_FIRST_FRAME)
+        print_startup_report();
+}
+
+static GstPadProbeReturn
+_startup_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    StartupPhase phase = (StartupPhase) GPOINTER_TO_INT(user_data);
+
+    g_autoptr(GstElement) element = gst_pad_get_parent_element(pad);
+
+    gst_element_post_message(element,
+        gst_message_new_application(GST_OBJECT(element),
+            gst_structure_new("startup-phase",
+                "phase", G_TYPE_INT, (gint) phase,
+                "time", G_TYPE_INT64, g_get_monotonic_time(), NULL)));
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+watch_startup(GstElement* element, const gchar* pad_name, StartupPhase phase)
+{
+    g_autoptr(GstPad) pad = gst_element_get_static_pad(element, pad_name);
+
+    if (startup.ends[phase] == 0)
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, _startup_probe_cb,
+            GINT_TO_POINTER(phase), NULL);
+}
+
+static void
+prepare_fast_start(void)
+{
+    g_autofree gchar* dir = NULL;
+
+    if (options.registry == NULL)
+        options.registry = g_build_filename(g_get_user_cache_dir(),
+            "RTP-over-SRT", "registry.bin", NULL);
+
+    dir = g_path_get_dirname(options.registry);
+    g_mkdir_with_parents(dir, 0755);
+
+    /* Read by gst_init(); an explicit GST_REGISTRY or GST_REGISTRY_UPDATE
+     * wins */
+    g_setenv("GST_REGISTRY", options.registry, FALSE);
+
+    if (g_file_test(options.registry, G_FILE_TEST_EXISTS)) {
+        g_setenv("GST_REGISTRY_UPDATE", "no", FALSE);
+        g_print("registry cache: %s\n", options.registry);
+    }
+    else {
+        g_print("registry cache: %s (building)\n", options.registry);
+    }
+}
+
+static void
+add_preload(GPtrArray* names, const gchar* description)
+{
+    g_autofree gchar* name = NULL;
+    guint i;
+
+    if (description == NULL || *description == '\0')
+        return;
+
+    /* Sinks and decoders may come with properties */
+    name = g_strndup(description, strcspn(description, " "));
+
+    for (i = 0; i < names->len; i++) {
+        if (g_strcmp0((const gchar *) g_ptr_array_index(names, i), name) == 0)
+            return;
+    }
+
+    g_ptr_array_add(names, g_steal_pointer(&name));
+}
+
+static void
+preload_plugins(void)
+{
+    g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func(g_free);
+    guint pt, i, loaded = 0;
+
+    add_preload(names, "srtsrc");
+
+    if (options.listen_port > 0)
+        add_preload(names, "appsrc");
+    add_preload(names, "queue");
+    add_preload(names, "valve");
+
+    if (options.bond)
+        add_preload(names, "funnel");
+
+    if (options.relay != NULL) {
+        add_preload(names, "tee");
+        add_preload(names, "srtsink");
+    }
+    else {
+        add_preload(names, "rtpptdemux");
+    }
+
+    if (app.jitter_latency > 0)
+        add_preload(names, "rtpjitterbuffer");
+
+    if (options.record != NULL) {
+        add_preload(names, "tee");
+        add_preload(names, "splitmuxsink");
+    }
+
+    if (options.multiview)
+        add_preload(names, element_available("d3d11compositor") ?
+            "d3d11compositor" : "compositor");
+
+    for (pt = 0; pt < RTP_PAYLOAD_TYPES && options.relay == NULL; pt++) {
+        gint codec;
+
+        if (app.pt_caps[pt] == NULL)
+            continue;
+
+        codec = get_video_codec(pt);
+        if (codec >= 0) {
+            add_preload(names, video_codecs[codec].depay);
+            add_preload(names, video_codecs[codec].parse);
+
+            if (g_strcmp0(options.bench, "transport") != 0)
+                add_preload(names, app.video[codec].decoder);
+            if (options.bench == NULL && !options.multiview)
+                add_preload(names, app.video[codec].sink);
+            continue;
+        }
+
+        codec = get_audio_codec(pt);
+        if (codec >= 0) {
+            add_preload(names, audio_codecs[codec].depay);
+            add_preload(names, audio_codecs[codec].factory);
+            add_preload(names, app.audio_sink);
+            continue;
+        }
+
+        if (g_strcmp0(get_encoding_name(pt), "X-GST") == 0) {
+            add_preload(names, "rtpgstdepay");
+            add_preload(names, "appsink");
+        }
+    }
+
+    for (i = 0; i < names->len; i++) {
+        const gchar* name = (const gchar *) g_ptr_array_index(names, i);
+
+        g_autoptr(GstElementFactory) factory = gst_element_factory_find(name);
+        g_autoptr(GstPluginFeature) feature = NULL;
+
+        if (factory == NULL) {
+            g_printerr("fast start: %s is not installed\n", name);
+            continue;
+        }
+
+        /* Loads the whole plugin, so the pipeline only has to look it up */
+        feature = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+
+        if (feature == NULL)
+            g_printerr("fast start: failed to load %s\n", name);
+        else
+            loaded++;
+    }
+
+    g_print("fast start: preloaded %u of %u elements\n", loaded, names->len);
+}
+
+/**
+ * Section: Reconnect
+ *
+ * With --reconnect a caller stream whose srtsrc fails or reaches EOS only
+ * restarts that element, backing off from RECONNECT_MIN_DELAY up to
+ * RECONNECT_MAX_DELAY. The EOS is dropped before it reaches the sink bins,
+ * so decoders and sinks keep running and the depayloader waits for the next
+ * keyframe. Listener streams are not restarted; the caller simply connects
+ * again.
+ */
+
+static gboolean
+can_reconnect(Stream* stream)
+{
+    /* Listener streams are the ones with a stream ID of their own */
+    return options.reconnect && stream->streamid == NULL;
+}
+
+static GstPadProbeReturn
+_srtsrc_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        /* First packet after a restart */
+        if (g_atomic_int_compare_and_exchange(&stream->reconnecting, 1, 0)) {
+            gst_element_post_message(stream->srtsrc,
+                gst_message_new_application(GST_OBJECT(stream->srtsrc),
+                    gst_structure_new_empty("srt-reconnected")));
+        }
+
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+        return GST_PAD_PROBE_OK;
+
+    /* The element can't be restarted from its own streaming thread */
+    gst_element_post_message(stream->srtsrc,
+        gst_message_new_application(GST_OBJECT(stream->srtsrc),
+            gst_structure_new_empty("srt-disconnected")));
+
+    return GST_PAD_PROBE_DROP;
+}
+
+static gboolean
+_reconnect_cb(gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+
+    stream->reconnect_source = 0;
+
+    g_print("stream %u: reconnecting to %s\n", stream->id, stream->uri);
+
+    /* A failed first connect leaves the whole pipeline short of PLAYING */
+    if (GST_STATE(app.pipeline) != GST_STATE_PLAYING)
+        gst_element_set_state(app.pipeline, GST_STATE_PLAYING);
+    else
+        gst_element_sync_state_with_parent(stream->srtsrc);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_reconnect(Stream* stream)
+{
+    if (stream->reconnect_source != 0)
+        return;
+
+    gst_element_set_state(stream->srtsrc, GST_STATE_NULL);
+
+    if (stream->reconnect_delay == 0)
+        stream->reconnect_delay = RECONNECT_MIN_DELAY;
+
+    g_print("stream %u: disconnected, retrying in %u ms\n", stream->id,
+        stream->reconnect_delay);
+
+    g_atomic_int_set(&stream->reconnecting, 1);
+    stream->reconnects++;
+    stream->reconnect_source =
+        g_timeout_add(stream->reconnect_delay, _reconnect_cb, stream);
+
+    stream->reconnect_delay =
+        MIN(stream->reconnect_delay * 2, RECONNECT_MAX_DELAY);
+}
+
+static void
+watch_srtsrc(Stream* stream)
+{
+    g_autoptr(GstPad) pad = gst_element_get_static_pad(stream->srtsrc, "src");
+
+    gst_pad_add_probe(pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER |
+            GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), _srtsrc_probe_cb, stream,
+        NULL);
+}
+
+static gboolean
+_bus_watch(GstBus* bus, GstMessage* message, gpointer user_data)
+{
+    switch (message->type) {
+    case GST_MESSAGE_APPLICATION:
+        if (gst_message_has_name(message, "zero-copy")) {
+            const GstStructure* s = gst_message_get_structure(message);
+            gboolean active = FALSE;
+
+            gst_structure_get_boolean(s, "active", &active);
+            g_print("zero-copy path %s: %s\n", active ? "active" : "inactive",
+                gst_structure_get_string(s, "caps"));
+        }
+        else if (gst_message_has_name(message, "startup-phase")) {
+            const GstStructure* s = gst_message_get_structure(message);
+            gint phase = 0;
+            gint64 time = 0;
+
+            gst_structure_get_int(s, "phase", &phase);
+            gst_structure_get_int64(s, "time", &time);
+            mark_startup((StartupPhase) phase, time);
+        }
+        else if (gst_message_has_name(message, "srt-disconnected")) {
+            Stream* stream = find_stream(GST_MESSAGE_SRC(message));
+
+            if (stream != NULL)
+                schedule_reconnect(stream);
+        }
+        else if (gst_message_has_name(message, "srt-path-down")) {
+            Stream* stream = find_stream(GST_MESSAGE_SRC(message));
+            BondPath* path = NULL;
+
+            if (stream != NULL)
+                path = find_bond_path(stream, GST_MESSAGE_SRC(message));
+            if (path != NULL)
+                schedule_path_restart(stream, path);
+        }
+        else if (gst_message_has_name(message, "srt-reconnected")) {
+            Stream* stream = find_stream(GST_MESSAGE_SRC(message));
+
+            if (stream != NULL) {
+                g_print("stream %u: connected\n", stream->id);
+                stream->reconnect_delay = 0;
+                wait_for_keyframe(stream, "reconnected");
+            }
+        }
+        break;
+    case GST_MESSAGE_ERROR:{
+        g_autoptr(GError) err = NULL;
+        g_autofree gchar* debug = NULL;
+        Stream* stream = NULL;
+
+        /* Late messages from a stream that has already been removed */
+        if (!gst_object_has_as_ancestor(GST_MESSAGE_SRC(message),
+                GST_OBJECT(app.pipeline)))
+            break;
+
+        gst_message_parse_error(message, &err, &debug);
+
+        /* A failing stream only takes itself down */
+        stream = find_stream(GST_MESSAGE_SRC(message));
+        if (stream != NULL) {
+            RelayOutput* output =
+                find_relay_output(stream, GST_MESSAGE_SRC(message));
+            BondPath* path = find_bond_path(stream, GST_MESSAGE_SRC(message));
+
+            g_printerr("stream %u (%s): %s\n", stream->id, stream->uri,
+                err->message);
+
+            /* A relay output that went away doesn't stop the others */
+            if (output != NULL) {
+                schedule_relay_restart(output);
+                break;
+            }
+
+            /* Nor does one path of a bonded stream */
+            if (path != NULL) {
+                schedule_path_restart(stream, path);
+                break;
+            }
+
+            if (can_reconnect(stream)
+                && GST_MESSAGE_SRC(message) == GST_OBJECT(stream->srtsrc)) {
+                schedule_reconnect(stream);
+                break;
+            }
+
+            remove_stream(stream);
+
+            /* A failed first connect aborted the pipeline's state change, and
+             * with it the streams that did connect */
+            if (app.streams->len > 0
+                && GST_STATE(app.pipeline) != GST_STATE_PLAYING)
+                gst_element_set_state(app.pipeline, GST_STATE_PLAYING);
+
+            /* The listener keeps accepting new callers */
+            if (app.streams->len > 0 || options.listen_port > 0)
+                break;
+        }
+        else {
+            g_printerr("%s\n", err->message);
+        }
+
+        g_printerr("Terminated\n");
+        g_main_loop_quit(app.loop);
+        break;
+    }
+    case GST_MESSAGE_STATE_CHANGED:{
+        Stream* stream = NULL;
+        GstState state;
+
+        gst_message_parse_state_changed(message, NULL, &state, NULL);
+
+        /* --bond paths don't follow their bin, see start_bond_paths() */
+        if (state == GST_STATE_PLAYING)
+            stream = find_stream(GST_MESSAGE_SRC(message));
+        if (stream != NULL && GST_MESSAGE_SRC(message) == GST_OBJECT(stream->bin))
+            start_bond_paths(stream);
+        break;
+    }
+    case GST_MESSAGE_QOS:{
+        Stream* stream = find_stream(GST_MESSAGE_SRC(message));
+        GstFormat format;
+        guint64 processed, dropped;
+
+        /* Running totals of the sink that posted it */
+        gst_message_parse_qos_stats(message, &format, &processed, &dropped);
+
+        if (stream != NULL && format == GST_FORMAT_BUFFERS
+            && dropped != G_MAXUINT64) {
+            g_mutex_lock(&stream->overload_lock);
+            stream->qos_dropped = dropped;
+            g_mutex_unlock(&stream->overload_lock);
+        }
+        break;
+    }
+    case GST_MESSAGE_EOS:
+        g_printerr("Terminated\n");
+        g_main_loop_quit(app.loop);
+        break;
+    default:
+        break;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GstCaps*
+_request_pt_map_cb(GstElement* demux, guint pt, gpointer user_data)
+{
+    /* Unmapped payload types never get here, see _pt_filter_cb() */
+    if (pt >= RTP_PAYLOAD_TYPES || app.pt_caps[pt] == NULL)
+        return NULL;
+
+    return gst_caps_ref(app.pt_caps[pt]);
+}
+
+static GstPadProbeReturn
+_pt_filter_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    guint8 marker_pt = 0;
+
+    if (gst_buffer_get_size(buffer) < 12
+        || gst_buffer_extract(buffer, 1, &marker_pt, 1) != 1) {
+        if (g_atomic_int_add(&stream->short_dropped, 1) == 0)
+            g_printerr("stream %u: dropping packet of %" G_GSIZE_FORMAT
+                " bytes, too short for RTP\n", stream->id,
+                gst_buffer_get_size(buffer));
+
+        return GST_PAD_PROBE_DROP;
+    }
+
+    /* rtpptdemux fails the whole stream on a PT it has no caps for */
+    if (app.pt_caps[marker_pt & 0x7f] != NULL)
+        return GST_PAD_PROBE_OK;
+
+    if (g_atomic_int_add(&stream->unknown_pt_dropped, 1) == 0)
+        g_printerr("stream %u: dropping unmapped payload type %u\n",
+            stream->id, marker_pt & 0x7f);
+
+    return GST_PAD_PROBE_DROP;
+}
+
+/* rtpmux numbers the packets of all its payload types in one sequence, so
+ * after rtpptdemux every depayloader would see a gap for each packet of the
+ * other types, mark it DISCONT and wait for the next keyframe. Show each
+ * type a sequence of its own instead. Packets missing from the shared
+ * sequence could have been of any type, so each one still shows up as a
+ * gap to every type, on its next packet. */
+static GstPadProbeReturn
+_renumber_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    RtpSequence* sequence = NULL;
+    guint8 header[12];
+    guint32 ssrc;
+    guint16 seq, next;
+    guint pt;
+
+    if (gst_buffer_extract(buffer, 0, header, sizeof(header)) != sizeof(header))
+        return GST_PAD_PROBE_OK;
+
+    pt = header[1] & 0x7f;
+    seq = (guint16) ((header[2] << 8) | header[3]);
+    ssrc = ((guint32) header[8] << 24) | (header[9] << 16) | (header[10] << 8) |
+        header[11];
+
+    sequence = (RtpSequence *) g_hash_table_lookup(stream->sequences,
+        GUINT_TO_POINTER(ssrc));
+
+    if (sequence == NULL) {
+        if (g_hash_table_size(stream->sequences) >= RTP_SEQUENCE_MAX_SSRCS)
+            g_hash_table_remove_all(stream->sequences);
+
+        sequence = g_new0(RtpSequence, 1);
+        sequence->last_seq = -1;
+        g_hash_table_insert(stream->sequences, GUINT_TO_POINTER(ssrc),
+            sequence);
+    }
+
+    if (sequence->last_seq < 0) {
+        sequence->last_seq = seq;
+    }
+    else {
+        guint16 gap = (guint16) (seq - sequence->last_seq - 1);
+
+        /* Anything older is a duplicate or reordered; it keeps its place in
+         * the payload type's own sequence */
+        if (gap < 0x8000) {
+            sequence->lost += gap;
+            sequence->last_seq = seq;
+
+            /* Counted here rather than per depayloader, which would take
+             * the other payload types for loss */
+            if (gap > 0 && options.bench != NULL) {
+                g_mutex_lock(&stream->bench_lock);
+                stream->bench_lost += gap;
+                g_mutex_unlock(&stream->bench_lock);
+            }
+        }
+    }
+
+    if (!sequence->started[pt]) {
+        sequence->started[pt] = TRUE;
+        next = seq;
+    }
+    else {
+        next = (guint16) (sequence->next_seq[pt] +
+            (sequence->lost - sequence->lost_at[pt]));
+    }
+
+    sequence->next_seq[pt] = (guint16) (next + 1);
+    sequence->lost_at[pt] = sequence->lost;
+
+    if (next == seq)
+        return GST_PAD_PROBE_OK;
+
+    header[2] = next >> 8;
+    header[3] = next & 0xff;
+
+    buffer = gst_buffer_make_writable(buffer);
+    gst_buffer_fill(buffer, 2, header + 2, 2);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+set_property_if_exists(GstElement* element, const gchar* name,
+    const gchar* value)
+{
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != NULL)
+        gst_util_set_object_arg(G_OBJECT(element), name, value);
+}
+
+static void
+configure_low_latency_element(GstElement* element)
+{
+    GstElementFactory* factory = gst_element_get_factory(element);
+    const gchar* klass = NULL;
+
+    if (factory == NULL)
+        return;
+
+    klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+
+    if (strstr(klass, "Decoder") != NULL) {
+        /* Frame threading in libav holds back one frame per thread */
+        set_property_if_exists(element, "thread-type", "slice");
+        /* nvcodec decoders otherwise wait for a few frames of reordering */
+        set_property_if_exists(element, "max-display-delay", "0");
+    }
+    else if (strstr(klass, "Sink") != NULL && strstr(klass, "Audio") != NULL) {
+        /* Audio keeps clock sync either way, it is what video lines up
+         * with; just give it the device to itself */
+        set_property_if_exists(element, "exclusive", "true");
+    }
+    else if (strstr(klass, "Sink") != NULL && strstr(klass, "Video") != NULL) {
+        g_autofree gchar* lateness = NULL;
+
+        /* The jitterbuffer gives smooth timestamps, so keep clock sync and
+         * only drop what is clearly late; without it, render on arrival. */
+        if (app.jitter_latency > 0) {
+            lateness = g_strdup_printf("%" G_GUINT64_FORMAT,
+                (guint64) LOW_LATENCY_MAX_LATENESS * GST_MSECOND);
+            set_property_if_exists(element, "max-lateness", lateness);
+        }
+        else {
+            set_property_if_exists(element, "sync", "false");
+        }
+    }
+}
+
+static void
+_configure_low_latency_cb(const GValue* value, gpointer user_data)
+{
+    configure_low_latency_element(GST_ELEMENT(g_value_get_object(value)));
+}
+
+static void
+_deep_element_added_cb(GstBin* bin, GstBin* sub_bin, GstElement* element,
+    gpointer user_data)
+{
+    configure_low_latency_element(element);
+}
+
+static void
+configure_low_latency(GstElement* sinkbin)
+{
+    GstIterator* it = NULL;
+
+    if (!options.low_latency)
+        return;
+
+    it = gst_bin_iterate_recurse(GST_BIN(sinkbin));
+    gst_iterator_foreach(it, _configure_low_latency_cb, NULL);
+    gst_iterator_free(it);
+
+    /* decodebin and autovideosink only plug their children later on */
+    g_signal_connect(sinkbin, "deep-element-added",
+        G_CALLBACK(_deep_element_added_cb), NULL);
+}
+
+/**
+ * Latency:
+ *
+ * The sender puts LATENCY_PROBE_PREFIX plus its wall-clock time on the X-GST
+ * payload type right before the matching video frame enters the encoder.
+ * The receiver pairs the probe with the first video frame past the one it
+ * had seen when the probe arrived, and takes the difference between the
+ * probe and the moment that frame is rendered. Both hosts need synchronized
+ * wall clocks (NTP/PTP), unless sender and receiver run on the same box.
+ */
+
+static gint
+_compare_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a;
+    gint64 y = *(const gint64 *) b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static gboolean
+get_latency_percentiles(Stream* stream, guint* count, gdouble* p50,
+    gdouble* p99)
+{
+    g_autoptr(GArray) sorted = NULL;
+
+    g_mutex_lock(&stream->latency_lock);
+    sorted = g_array_sized_new(FALSE, FALSE, sizeof(gint64),
+        stream->latency_samples->len);
+    g_array_append_vals(sorted, stream->latency_samples->data,
+        stream->latency_samples->len);
+    g_mutex_unlock(&stream->latency_lock);
+
+    *count = sorted->len;
+    if (sorted->len == 0)
+        return FALSE;
+
+    g_array_sort(sorted, _compare_gint64);
+
+    *p50 = g_array_index(sorted, gint64, (sorted->len - 1) * 50 / 100) / 1000.0;
+    *p99 = g_array_index(sorted, gint64, (sorted->len - 1) * 99 / 100) / 1000.0;
+
+    return TRUE;
+}
+
+static GstPadProbeReturn
+_latency_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    LatencyProbe probe;
+
+    gchar text[64];
+    gsize len;
+
+    len = gst_buffer_extract(buffer, 0, text, sizeof(text) - 1);
+    text[len] = '\0';
+
+    if (!g_str_has_prefix(text, LATENCY_PROBE_PREFIX))
+        return GST_PAD_PROBE_OK;
+
+    probe.wallclock =
+        g_ascii_strtoll(text + strlen(LATENCY_PROBE_PREFIX), NULL, 10);
+
+    g_mutex_lock(&stream->latency_lock);
+    probe.after_pts = stream->last_video_pts;
+    if (stream->pending_probes->len < LATENCY_MAX_PENDING)
+        g_array_append_val(stream->pending_probes, probe);
+    g_mutex_unlock(&stream->latency_lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+_video_depay_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    g_mutex_lock(&stream->latency_lock);
+    if (GST_BUFFER_PTS(buffer) != GST_CLOCK_TIME_NONE)
+        stream->last_video_pts = GST_BUFFER_PTS(buffer);
+    g_mutex_unlock(&stream->latency_lock);
+
+    check_first_keyframe(stream);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static gint64
+get_render_delay(GstElement* sink, GstClockTime pts)
+{
+    g_autoptr(GstClock) clock = NULL;
+    GstClockTime render_time;
+    GstClockTime now;
+    gboolean sync = TRUE;
+
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(sink), "sync") != NULL)
+        g_object_get(sink, "sync", &sync, NULL);
+
+    clock = gst_element_get_clock(sink);
+    if (!sync || clock == NULL || pts == GST_CLOCK_TIME_NONE)
+        return 0;
+
+    /* Live streams start their segment at 0, so PTS is the running time */
+    render_time = gst_element_get_base_time(sink) + pts +
+        gst_pipeline_get_latency(GST_PIPELINE(app.pipeline));
+    now = gst_clock_get_time(clock);
+
+    return render_time > now ? (gint64) (render_time - now) / 1000 : 0;
+}
+
+static GstPadProbeReturn
+_video_render_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+
+    g_autoptr(GstElement) sink = NULL;
+    gint64 rendered;
+
+    g_mutex_lock(&stream->latency_lock);
+    if (stream->pending_probes->len == 0) {
+        g_mutex_unlock(&stream->latency_lock);
+        return GST_PAD_PROBE_OK;
+    }
+    g_mutex_unlock(&stream->latency_lock);
+
+    sink = gst_pad_get_parent_element(pad);
+    rendered = g_get_real_time() + get_render_delay(sink, pts);
+
+    g_mutex_lock(&stream->latency_lock);
+    while (stream->pending_probes->len > 0) {
+        LatencyProbe* probe =
+            &g_array_index(stream->pending_probes, LatencyProbe, 0);
+        gint64 latency = rendered - probe->wallclock;
+
+        if (probe->after_pts != GST_CLOCK_TIME_NONE && pts <= probe->after_pts)
+            break;
+
+        /* Keep the most recent samples only */
+        if (stream->latency_samples->len < LATENCY_MAX_SAMPLES)
+            g_array_append_val(stream->latency_samples, latency);
+        else
+            g_array_index(stream->latency_samples, gint64,
+                stream->next_latency_sample) = latency;
+        stream->next_latency_sample =
+            (stream->next_latency_sample + 1) % LATENCY_MAX_SAMPLES;
+
+        g_array_remove_index(stream->pending_probes, 0);
+    }
+    g_mutex_unlock(&stream->latency_lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * Metadata:
+ *
+ * The X-GST payload ends in an appsink. Its streaming thread only moves the
+ * sample into a bounded ring, dropping the oldest when the application falls
+ * behind; handle_metadata() then runs on the main loop.
+ */
+
+static void
+handle_metadata(Stream* stream, GstSample* sample)
+{
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+
+    if (options.dump_metadata)
+        g_print("stream %u metadata: %" G_GSIZE_FORMAT " bytes, pts %"
+            GST_TIME_FORMAT "\n", stream->id, gst_buffer_get_size(buffer),
+            GST_TIME_ARGS(GST_BUFFER_PTS(buffer)));
+}
+
+static gboolean
+_metadata_dispatch_cb(gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstSample* sample = NULL;
+
+    for (;;) {
+        g_mutex_lock(&stream->metadata_lock);
+        if (stream->metadata_len == 0) {
+            stream->metadata_source = 0;
+            g_mutex_unlock(&stream->metadata_lock);
+            break;
+        }
+
+        sample = stream->metadata_ring[stream->metadata_head];
+        stream->metadata_ring[stream->metadata_head] = NULL;
+        stream->metadata_head = (stream->metadata_head + 1) % options.metadata_buffers;
+        stream->metadata_len--;
+        g_mutex_unlock(&stream->metadata_lock);
+
+        handle_metadata(stream, sample);
+        gst_sample_unref(sample);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static GstFlowReturn
+_metadata_new_sample_cb(GstAppSink* appsink, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstSample* sample = gst_app_sink_pull_sample(appsink);
+    guint tail;
+
+    if (sample == NULL)
+        return GST_FLOW_FLUSHING;
+
+    g_mutex_lock(&stream->metadata_lock);
+
+    if (stream->metadata_len == (guint) options.metadata_buffers) {
+        gst_sample_unref(stream->metadata_ring[stream->metadata_head]);
+        stream->metadata_head = (stream->metadata_head + 1) % options.metadata_buffers;
+        stream->metadata_len--;
+        stream->metadata_dropped++;
+    }
+
+    tail = (stream->metadata_head + stream->metadata_len) % options.metadata_buffers;
+    stream->metadata_ring[tail] = sample;
+    stream->metadata_len++;
+
+    if (stream->metadata_source == 0)
+        stream->metadata_source = g_idle_add(_metadata_dispatch_cb, stream);
+
+    g_mutex_unlock(&stream->metadata_lock);
+
+    return GST_FLOW_OK;
+}
+
+static GstPadProbeReturn
+_video_caps_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    GstCaps* caps = NULL;
+    GstCapsFeatures* features = NULL;
+
+    g_autoptr(GstElement) sink = NULL;
+    g_autofree gchar* caps_str = NULL;
+
+    gboolean active;
+
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+        return GST_PAD_PROBE_OK;
+
+    gst_event_parse_caps(event, &caps);
+
+    features = gst_caps_get_features(caps, 0);
+    /* D3D11 on Windows; DMABuf, VA or GL memory on Linux */
+    active = features != NULL && !gst_caps_features_is_any(features)
+        && !gst_caps_features_contains(features,
+        GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY);
+
+    caps_str = gst_caps_to_string(caps);
+    sink = gst_pad_get_parent_element(pad);
+
+    /* Report from the bus thread, not from the streaming thread */
+    gst_element_post_message(sink,
+        gst_message_new_application(GST_OBJECT(sink),
+            gst_structure_new("zero-copy",
+                "active", G_TYPE_BOOLEAN, active,
+                "caps", G_TYPE_STRING, caps_str, NULL)));
+
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * Section: Multiview
+ *
+ * --multiview shows every video stream as a tile of one window instead of
+ * opening a sink per stream. The video sink bins end in a queue whose
+ * output goes to a pad of a single compositor, d3d11compositor when there
+ * is one, so decoded D3D11 frames are scaled on the GPU and the whole wall
+ * is presented once per frame. Tiles are laid out in a grid that is
+ * recomputed whenever a stream comes or goes.
+ *
+ * Linking across the two bins ghosts the compositor pad's peer out of the
+ * multiview bin, and removing a stream bin only breaks the outer link, so
+ * the compositor pad stays linked to that ghost. Each sink bin therefore
+ * keeps the compositor pad and the ghost it was given, and both are
+ * released with the stream.
+ */
+
+typedef struct
+{
+    GstPad* pad;
+    GstPad* ghost;
+} MultiviewTile;
+
+static void
+multiview_tile_free(gpointer data)
+{
+    MultiviewTile* tile = (MultiviewTile *) data;
+
+    gst_object_unref(tile->pad);
+    if (tile->ghost != NULL)
+        gst_object_unref(tile->ghost);
+    g_free(tile);
+}
+
+static void
+_collect_pad_cb(const GValue* value, gpointer user_data)
+{
+    g_ptr_array_add((GPtrArray *) user_data,
+        gst_object_ref(g_value_get_object(value)));
+}
+
+static GPtrArray*
+get_multiview_pads(void)
+{
+    GPtrArray* pads = g_ptr_array_new_with_free_func(gst_object_unref);
+    GstIterator* it = gst_element_iterate_sink_pads(app.compositor);
+
+    gst_iterator_foreach(it, _collect_pad_cb, pads);
+    gst_iterator_free(it);
+
+    return pads;
+}
+
+static void
+layout_multiview(void)
+{
+    GPtrArray* pads = get_multiview_pads();
+    guint cols, rows, i;
+
+    if (pads->len == 0) {
+        g_ptr_array_unref(pads);
+        return;
+    }
+
+    /* As square as possible; 16 streams make a 4x4 wall */
+    cols = 1;
+    while (cols * cols < pads->len)
+        cols++;
+    rows = (pads->len + cols - 1) / cols;
+
+    for (i = 0; i < pads->len; i++) {
+        g_object_set(g_ptr_array_index(pads, i),
+            "xpos", (gint) ((i % cols) * MULTIVIEW_WIDTH / cols),
+            "ypos", (gint) ((i / cols) * MULTIVIEW_HEIGHT / rows),
+            "width", (gint) (MULTIVIEW_WIDTH / cols),
+            "height", (gint) (MULTIVIEW_HEIGHT / rows), NULL);
+    }
+
+    g_print("multiview: %u tiles, %ux%u\n", pads->len, cols, rows);
+
+    g_ptr_array_unref(pads);
+}
+
+static void
+add_multiview_src(GstElement* sinkbin)
+{
+    g_autoptr(GstElement) videosink = NULL;
+    g_autoptr(GstPad) pad = NULL;
+
+    videosink = gst_bin_get_by_name(GST_BIN(sinkbin), "videosink");
+    pad = gst_element_get_static_pad(videosink, "src");
+    gst_element_add_pad(sinkbin, gst_ghost_pad_new("src", pad));
+}
+
+static void
+link_multiview(GstElement* sinkbin)
+{
+    g_autoptr(GstPad) src = gst_element_get_static_pad(sinkbin, "src");
+    g_autoptr(GstPad) peer = NULL;
+    MultiviewTile* tile = NULL;
+    GstPad* pad = NULL;
+
+    /* A sink bin that is only being relinked keeps its tile */
+    if (src == NULL || gst_pad_is_linked(src))
+        return;
+
+    pad = gst_element_request_pad_simple(app.compositor, "sink_%u");
+
+    /* Ghosts the pad out through the stream bin and the multiview bin */
+    if (!gst_pad_link_maybe_ghosting(src, pad)) {
+        g_printerr("failed to link %s to the multiview\n",
+            GST_ELEMENT_NAME(sinkbin));
+        gst_element_release_request_pad(app.compositor, pad);
+        gst_object_unref(pad);
+        return;
+    }
+
+    tile = g_new0(MultiviewTile, 1);
+    tile->pad = pad;
+
+    /* The internal pad of the ghost on the multiview bin */
+    peer = gst_pad_get_peer(pad);
+    if (peer != NULL && GST_IS_PROXY_PAD(peer))
+        tile->ghost =
+            GST_PAD(gst_proxy_pad_get_internal(GST_PROXY_PAD(peer)));
+
+    g_object_set_data_full(G_OBJECT(sinkbin), "multiview-tile", tile,
+        multiview_tile_free);
+
+    layout_multiview();
+}
+
+static void
+release_multiview_tiles(Stream* stream)
+{
+    GHashTableIter iter;
+    gpointer sinkbin;
+
+    g_hash_table_iter_init(&iter, stream->sinkbins);
+
+    while (g_hash_table_iter_next(&iter, NULL, &sinkbin)) {
+        MultiviewTile* tile = (MultiviewTile *)
+            g_object_get_data(G_OBJECT(sinkbin), "multiview-tile");
+
+        g_autoptr(GstElement) multiview = NULL;
+
+        if (tile == NULL)
+            continue;
+
+        gst_element_release_request_pad(app.compositor, tile->pad);
+
+        if (tile->ghost != NULL)
+            multiview = gst_pad_get_parent_element(tile->ghost);
+        if (multiview != NULL)
+            gst_element_remove_pad(multiview, tile->ghost);
+
+        g_object_set_data(G_OBJECT(sinkbin), "multiview-tile", NULL);
+    }
+
+    layout_multiview();
+}
+
+static gboolean
+add_multiview(GstElement* pipeline, GError** error)
+{
+    GstElement* bin = NULL;
+
+    g_autofree gchar* description = NULL;
+
+    /* Frames from the D3D11 decoders never leave the GPU */
+    if (element_available("d3d11compositor"))
+        description = g_strdup("d3d11compositor name=compositor "
+            "background=black ! d3d11videosink async=false");
+    else
+        description = g_strdup_printf("compositor name=compositor "
+            "background=black ! videoconvert ! %s async=false",
+            display_video_sink());
+
+    bin = gst_parse_bin_from_description(description, FALSE, error);
+
+    if (bin == NULL)
+        return FALSE;
+
+    gst_object_set_name(GST_OBJECT(bin), "multiview");
+    gst_bin_add(GST_BIN(pipeline), bin);
+
+    app.compositor = gst_bin_get_by_name(GST_BIN(bin), "compositor");
+
+    g_print("multiview: %s\n", description);
+
+    return TRUE;
+}
+
+/**
+ * Section: Recording
+ *
+ * --record tees the parsed, still compressed video into splitmuxsink, so
+ * archiving costs a mux and a write per frame and no decode. Segments are
+ * MPEG-TS or fragmented MP4, both of which stay readable when the process
+ * is killed without finalizing the last file. The branch has its own leaky
+ * queue so a slow disk drops recording data instead of stalling the live
+ * path, and the file sink writes in large blocks.
+ *
+ * Before a stream or the pipeline goes to NULL, EOS is sent into each
+ * recording branch and teardown waits, up to RECORD_FINALIZE_TIMEOUT, for
+ * the recorder to pass it on, so the muxer writes the end of the last
+ * segment. The sink bin forwards its children's EOS to the bus, where the
+ * sync handler picks the recorder's out, since a bin whose other sinks are
+ * still playing would otherwise keep it.
+ */
+
+static gchar*
+build_record_branch(const VideoCodecInfo* info)
+{
+    gboolean mp4 = g_strcmp0(options.record_format, "mp4") == 0;
+
+    if (options.record == NULL)
+        return g_strdup("");
+
+    /* *INDENT-OFF* */
+    return g_strdup_printf(" rec. ! valve name=record ! queue name=recq max-size-buffers=0 max-size-bytes=0"
+        " max-size-time=%" G_GUINT64_FORMAT " leaky=downstream ! %s ! "
+        "splitmuxsink name=recorder muxer-factory=%s max-size-time=%" G_GUINT64_FORMAT,
+        (guint64) RECORD_QUEUE_TIME * GST_SECOND,
+        info->parse,
+        mp4 ? "mp4mux" : "mpegtsmux",
+        (guint64) options.segment_time * GST_SECOND);
+    /* *INDENT-ON* */
+}
+
+static void
+_recorder_element_added_cb(GstBin* bin, GstElement* element,
+    gpointer user_data)
+{
+    g_autofree gchar* size = NULL;
+
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(element),
+            "buffer-mode") == NULL)
+        return;
+
+    size = g_strdup_printf("%d", RECORD_FILE_BUFFER);
+    set_property_if_exists(element, "buffer-mode", "full");
+    set_property_if_exists(element, "buffer-size", size);
+}
+
+static void
+configure_recorder(GstElement* sinkbin, Stream* stream, guint pt)
+{
+    g_autoptr(GstElement) recorder = NULL;
+    g_autofree gchar* basename = NULL;
+    g_autofree gchar* location = NULL;
+    gboolean mp4 = g_strcmp0(options.record_format, "mp4") == 0;
+
+    if (options.record == NULL)
+        return;
+
+    recorder = gst_bin_get_by_name(GST_BIN(sinkbin), "recorder");
+
+    basename = g_strdup_printf("stream%u-pt%u-%%05d.%s", stream->id, pt,
+        mp4 ? "mp4" : "ts");
+    location = g_build_filename(options.record, basename, NULL);
+    g_object_set(recorder, "location", location, NULL);
+
+    /* Moof every second, so a cut-off file loses at most that much */
+    if (mp4)
+        set_property_if_exists(recorder, "muxer-properties",
+            "properties,fragment-duration=1000");
+
+    g_signal_connect(recorder, "element-added",
+        G_CALLBACK(_recorder_element_added_cb), NULL);
+
+    g_object_set(sinkbin, "message-forward", TRUE, NULL);
+
+    g_print("stream %u: recording pt %u to %s\n", stream->id, pt, location);
+}
+
+static void
+note_recorder_eos(GstMessage* forwarded)
+{
+    const GstStructure* structure = gst_message_get_structure(forwarded);
+    GstMessage* message = NULL;
+    GstObject* recorder;
+
+    gst_structure_get(structure, "message", GST_TYPE_MESSAGE, &message, NULL);
+
+    if (message == NULL)
+        return;
+
+    recorder = GST_MESSAGE_SRC(message);
+
+    /* Only the recorders finalize_recordings() is waiting for */
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS
+        && g_object_get_data(G_OBJECT(recorder), "finalizing") != NULL) {
+        g_object_set_data(G_OBJECT(recorder), "finalizing", NULL);
+
+        g_mutex_lock(&app.record_lock);
+        if (app.record_pending > 0)
+            app.record_pending--;
+        g_cond_signal(&app.record_cond);
+        g_mutex_unlock(&app.record_lock);
+    }
+
+    gst_message_unref(message);
+}
+
+static void
+finalize_recordings(Stream* stream)
+{
+    GHashTableIter iter;
+    gpointer sinkbin;
+    gint64 end_time;
+    guint pending = 0;
+
+    if (options.record == NULL)
+        return;
+
+    g_hash_table_iter_init(&iter, stream->sinkbins);
+
+    while (g_hash_table_iter_next(&iter, NULL, &sinkbin)) {
+        g_autoptr(GstElement) recorder =
+            gst_bin_get_by_name(GST_BIN(sinkbin), "recorder");
+        g_autoptr(GstElement) valve = NULL;
+        g_autoptr(GstElement) recq = NULL;
+        g_autoptr(GstPad) pad = NULL;
+
+        if (recorder == NULL)
+            continue;
+
+        valve = gst_bin_get_by_name(GST_BIN(sinkbin), "record");
+        recq = gst_bin_get_by_name(GST_BIN(sinkbin), "recq");
+        pad = gst_element_get_static_pad(recq, "sink");
+
+        /* Nothing goes in behind the EOS */
+        g_object_set(valve, "drop", TRUE, NULL);
+
+        g_mutex_lock(&app.record_lock);
+        app.record_pending++;
+        g_mutex_unlock(&app.record_lock);
+        g_object_set_data(G_OBJECT(recorder), "finalizing",
+            GINT_TO_POINTER(TRUE));
+
+        /* Refused by a branch that never started or already saw EOS */
+        if (gst_pad_send_event(pad, gst_event_new_eos())) {
+            pending++;
+            continue;
+        }
+
+        g_object_set_data(G_OBJECT(recorder), "finalizing", NULL);
+        g_mutex_lock(&app.record_lock);
+        app.record_pending--;
+        g_mutex_unlock(&app.record_lock);
+    }
+
+    if (pending == 0)
+        return;
+
+    end_time = g_get_monotonic_time() +
+        RECORD_FINALIZE_TIMEOUT * G_TIME_SPAN_SECOND;
+
+    g_mutex_lock(&app.record_lock);
+
+    while (app.record_pending > 0) {
+        if (!g_cond_wait_until(&app.record_cond, &app.record_lock, end_time)) {
+            g_printerr("stream %u: %u recording(s) not finalized\n",
+                stream->id, app.record_pending);
+            app.record_pending = 0;
+            break;
+        }
+    }
+
+    g_mutex_unlock(&app.record_lock);
+}
+
+/**
+ * Section: Overload
+ *
+ * --overload sets how far a video branch may degrade when the host can't
+ * keep up, instead of letting frames pile up in front of the decoder. Load
+ * is judged per frame, from the QoS events the video sink sends upstream
+ * and from how much the queue in front of the decoder holds. Decoding
+ * degrades a level at a time: 'drop' skips frames the parser marked
+ * droppable, i.e. no other frame refers to them, 'keyframes' then decodes
+ * keyframes only. Both skip the frames ahead of the decoder, behind the
+ * recording tee. Coming back from keyframes-only waits for the next
+ * keyframe, since the frames in between refer to ones that were skipped.
+ */
+
+typedef struct
+{
+    Stream* stream;
+    GstElement* queue;
+} OverloadProbe;
+
+static void
+overload_probe_free(gpointer data)
+{
+    OverloadProbe* probe = (OverloadProbe *) data;
+
+    gst_object_unref(probe->queue);
+    g_free(probe);
+}
+
+static void
+note_load(Stream* stream, gboolean late)
+{
+    gboolean resync = FALSE;
+    gint level;
+
+    g_mutex_lock(&stream->overload_lock);
+    level = stream->overload_level;
+
+    if (late) {
+        stream->overload_fine = 0;
+
+        if (++stream->overload_late >= OVERLOAD_ESCALATE
+            && level < options.overload_policy) {
+            stream->overload_level++;
+            stream->overload_late = 0;
+        }
+    }
+    else {
+        stream->overload_late = 0;
+
+        if (++stream->overload_fine >= OVERLOAD_RECOVER && level > OVERLOAD_NONE) {
+            if (level == OVERLOAD_KEYFRAMES)
+                stream->overload_resync = resync = TRUE;
+
+            stream->overload_level--;
+            stream->overload_fine = 0;
+        }
+    }
+
+    if (level != stream->overload_level) {
+        g_print("stream %u: %s, overload level %s -> %s\n", stream->id,
+            late ? "overloaded" : "recovering", overload_levels[level],
+            overload_levels[stream->overload_level]);
+    }
+    g_mutex_unlock(&stream->overload_lock);
+
+    if (resync)
+        request_keyframe(stream, "overload recovered");
+}
+
+static GstPadProbeReturn
+_overload_qos_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    GstQOSType type;
+    gdouble proportion;
+    GstClockTimeDiff jitter;
+    GstClockTime timestamp;
+
+    if (GST_EVENT_TYPE(event) != GST_EVENT_QOS)
+        return GST_PAD_PROBE_OK;
+
+    /* Positive jitter is how late the frame was rendered; taken into
+     * account with the next frame */
+    gst_event_parse_qos(event, &type, &proportion, &jitter, &timestamp);
+    g_atomic_int_set(&stream->qos_late,
+        jitter > OVERLOAD_LATENESS * GST_MSECOND);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+_overload_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    OverloadProbe* probe = (OverloadProbe *) user_data;
+    Stream* stream = probe->stream;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    gboolean delta = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    gboolean drop = FALSE;
+    guint64 queued = 0;
+
+    /* Without a sink that syncs there are no QoS events, only the backlog */
+    g_object_get(probe->queue, "current-level-time", &queued, NULL);
+    note_load(stream, queued > OVERLOAD_QUEUE_TIME * GST_MSECOND
+        || g_atomic_int_get(&stream->qos_late));
+
+    g_mutex_lock(&stream->overload_lock);
+    if (stream->overload_resync && !delta)
+        stream->overload_resync = FALSE;
+
+    drop = (stream->overload_resync && delta)
+        || (stream->overload_level >= OVERLOAD_KEYFRAMES && delta)
+        || (stream->overload_level >= OVERLOAD_DROP
+        && GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DROPPABLE));
+
+    if (drop)
+        stream->overload_dropped++;
+    g_mutex_unlock(&stream->overload_lock);
+
+    return drop ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+static void
+configure_overload(GstElement* sinkbin, Stream* stream)
+{
+    g_autoptr(GstElement) valve = NULL;
+    g_autoptr(GstElement) videosink = NULL;
+    g_autoptr(GstPad) vpad = NULL;
+    g_autoptr(GstPad) spad = NULL;
+    OverloadProbe* probe = NULL;
+
+    if (options.overload_policy == OVERLOAD_NONE)
+        return;
+
+    probe = g_new0(OverloadProbe, 1);
+    probe->stream = stream;
+
+    /* The decoder's own thread, if it has one, is where a backlog shows */
+    probe->queue = gst_bin_get_by_name(GST_BIN(sinkbin), "decodeq");
+    if (probe->queue == NULL)
+        probe->queue = gst_bin_get_by_name(GST_BIN(sinkbin), "q");
+
+    valve = gst_bin_get_by_name(GST_BIN(sinkbin), "render");
+    vpad = gst_element_get_static_pad(valve, "src");
+    gst_pad_add_probe(vpad, GST_PAD_PROBE_TYPE_BUFFER, _overload_probe_cb,
+        probe, overload_probe_free);
+
+    videosink = gst_bin_get_by_name(GST_BIN(sinkbin), "videosink");
+    spad = gst_element_get_static_pad(videosink, "sink");
+    gst_pad_add_probe(spad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+        _overload_qos_probe_cb, stream, NULL);
+}
+
+/**
+ * Section: Bench
+ *
+ * --bench replaces every sink with 'fakesink sync=false'. The video branch
+ * either still decodes ('decode') or stops after the parser ('transport').
+ * Frames are counted at the video sink, compressed bytes at the
+ * depayloader and RTP sequence gaps per SSRC in front of rtpptdemux, where
+ * the payload types still share one sequence. CPU time is summed over the
+ * streaming threads the stream owns; each of them reports its own thread
+ * time from a buffer probe.
+ */
+
+static gint64
+get_thread_cpu_time(void)
+{
+#ifdef G_OS_WIN32
+    FILETIME creation, exit, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+
+    /* 100 ns units */
+    return (gint64) ((k.QuadPart + u.QuadPart) / 10);
+#else
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+}
+
+static GstPadProbeReturn
+_bench_thread_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    gint64 cpu = get_thread_cpu_time();
+    gint64* total = NULL;
+
+    g_mutex_lock(&stream->bench_lock);
+
+    total = (gint64 *) g_hash_table_lookup(stream->bench_thread_cpu,
+        g_thread_self());
+    if (total == NULL) {
+        total = g_new0(gint64, 1);
+        g_hash_table_insert(stream->bench_thread_cpu, g_thread_self(), total);
+    }
+    *total = cpu;
+
+    g_mutex_unlock(&stream->bench_lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+bench_thread(Stream* stream, GstElement* element)
+{
+    g_autoptr(GstPad) pad = gst_element_get_static_pad(element, "src");
+
+    if (pad != NULL)
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, _bench_thread_probe_cb,
+            stream, NULL);
+}
+
+static void
+_bench_queue_cb(const GValue* value, gpointer user_data)
+{
+    GstElement* element = GST_ELEMENT(g_value_get_object(value));
+    GstElementFactory* factory = gst_element_get_factory(element);
+
+    /* A queue is where a new streaming thread starts */
+    if (factory != NULL
+        && g_strcmp0(GST_OBJECT_NAME(factory), "queue") == 0)
+        bench_thread((Stream *) user_data, element);
+}
+
+static void
+bench_threads(Stream* stream, GstElement* bin)
+{
+    GstIterator* it = NULL;
+
+    if (options.bench == NULL)
+        return;
+
+    it = gst_bin_iterate_recurse(GST_BIN(bin));
+    gst_iterator_foreach(it, _bench_queue_cb, stream);
+    gst_iterator_free(it);
+}
+
+static GstPadProbeReturn
+_bench_depay_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    /* Loss is counted per SSRC, in _renumber_probe_cb() */
+    g_mutex_lock(&stream->bench_lock);
+    stream->bench_bytes += gst_buffer_get_size(buffer);
+    g_mutex_unlock(&stream->bench_lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+_bench_frame_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&stream->bench_lock);
+    if (stream->bench_frames++ == 0)
+        stream->bench_first_frame = now;
+    stream->bench_last_frame = now;
+    g_mutex_unlock(&stream->bench_lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+bench_video_sinkbin(Stream* stream, GstElement* sinkbin)
+{
+    g_autoptr(GstElement) depay = NULL;
+    g_autoptr(GstElement) videosink = NULL;
+    g_autoptr(GstPad) dsrc = NULL;
+    g_autoptr(GstPad) vpad = NULL;
+
+    if (options.bench == NULL)
+        return;
+
+    depay = gst_bin_get_by_name(GST_BIN(sinkbin), "depay");
+    dsrc = gst_element_get_static_pad(depay, "src");
+    gst_pad_add_probe(dsrc, GST_PAD_PROBE_TYPE_BUFFER, _bench_depay_probe_cb,
+        stream, NULL);
+
+    videosink = gst_bin_get_by_name(GST_BIN(sinkbin), "videosink");
+    vpad = gst_element_get_static_pad(videosink, "sink");
+    gst_pad_add_probe(vpad, GST_PAD_PROBE_TYPE_BUFFER, _bench_frame_probe_cb,
+        stream, NULL);
+}
+
+static guint64
+get_jitterbuffer_late(Stream* stream)
+{
+    GHashTableIter iter;
+    gpointer value;
+    guint64 late = 0;
+
+    g_hash_table_iter_init(&iter, stream->sinkbins);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_autoptr(GstElement) jitterbuffer =
+            gst_bin_get_by_name(GST_BIN(value), "jitterbuffer");
+        GstStructure* stats = NULL;
+        guint64 num_late = 0;
+
+        if (jitterbuffer == NULL)
+            continue;
+
+        g_object_get(jitterbuffer, "stats", &stats, NULL);
+        if (stats != NULL) {
+            gst_structure_get_uint64(stats, "num-late", &num_late);
+            gst_structure_free(stats);
+        }
+        late += num_late;
+    }
+
+    return late;
+}
+
+static void
+print_bench_report(void)
+{
+    guint i;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+        GHashTableIter iter;
+        gpointer value;
+        gint64 cpu = 0;
+        gdouble seconds;
+
+        g_mutex_lock(&stream->bench_lock);
+
+        g_hash_table_iter_init(&iter, stream->bench_thread_cpu);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+            cpu += *(gint64 *) value;
+
+        seconds = (stream->bench_last_frame - stream->bench_first_frame) /
+            (gdouble) G_USEC_PER_SEC;
+
+        /* *INDENT-OFF* */
+        g_print("stream %u bench (%s): %" G_GUINT64_FORMAT " frames in %.1f s, "
+            "%.1f fps, %.2f Mbps, %" G_GUINT64_FORMAT " lost, %" G_GUINT64_FORMAT
+            " late, cpu %.2f s (%.0f%% of a core)\n",
+            stream->id, options.bench,
+            stream->bench_frames, seconds,
+            seconds > 0 ? (stream->bench_frames - 1) / seconds : 0.0,
+            seconds > 0 ? stream->bench_bytes * 8 / seconds / 1000000 : 0.0,
+            stream->bench_lost,
+            get_jitterbuffer_late(stream),
+            cpu / (gdouble) G_USEC_PER_SEC,
+            seconds > 0 ? cpu / (seconds * G_USEC_PER_SEC) * 100 : 0.0);
+        /* *INDENT-ON* */
+
+        g_mutex_unlock(&stream->bench_lock);
+    }
+}
+
+static gboolean
+_duration_cb(gpointer user_data)
+{
+    g_print("Duration reached\n");
+    g_main_loop_quit(app.loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_parse_bench_arg_cb(const gchar* option_name, const gchar* value,
+    gpointer data, GError** error)
+{
+    if (value == NULL || g_strcmp0(value, "decode") == 0)
+        options.bench = "decode";
+    else if (g_strcmp0(value, "transport") == 0)
+        options.bench = "transport";
+    else {
+        g_printerr("Invalid bench mode: %s\n", value);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Section: Instrumentation
+ *
+ * --instrument counts, per element and per second, what leaves its source
+ * pads: buffers, bytes, how many came from a buffer pool, and how many
+ * memories are new. A memory is new when it is not a sub-memory and was not
+ * seen on one of the element's sink pads shortly before, i.e. the element
+ * allocated it rather than passing it through. The check only looks at
+ * the last INSTRUMENT_SEEN_MEMORIES pointers and a freed memory can come
+ * back at the same address, so the allocation count is a lower bound.
+ */
+
+#define INSTRUMENT_SEEN_MEMORIES 16
+
+typedef struct
+{
+    gint ref;
+    GMutex lock;
+    gchar* path;
+
+    guint64 buffers;
+    guint64 bytes;
+    guint64 pooled;
+    guint64 memories;
+    guint64 allocated;
+
+    /* Memories seen on the sink pads, to tell pass-through from allocation */
+    GstMemory* seen[INSTRUMENT_SEEN_MEMORIES];
+    guint seen_next;
+} ElementStats;
+
+static ElementStats*
+element_stats_ref(ElementStats* stats)
+{
+    g_atomic_int_inc(&stats->ref);
+
+    return stats;
+}
+
+static void
+element_stats_unref(gpointer data)
+{
+    ElementStats* stats = (ElementStats *) data;
+
+    if (!g_atomic_int_dec_and_test(&stats->ref))
+        return;
+
+    g_mutex_clear(&stats->lock);
+    g_free(stats->path);
+    g_free(stats);
+}
+
+static gboolean
+was_seen(ElementStats* stats, GstMemory* memory)
+{
+    guint i;
+
+    for (i = 0; i < INSTRUMENT_SEEN_MEMORIES; i++) {
+        if (stats->seen[i] == memory)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+count_buffer(ElementStats* stats, GstPad* pad, GstBuffer* buffer)
+{
+    guint i, n = gst_buffer_n_memory(buffer);
+
+    if (GST_PAD_IS_SINK(pad)) {
+        for (i = 0; i < n; i++) {
+            stats->seen[stats->seen_next] = gst_buffer_peek_memory(buffer, i);
+            stats->seen_next = (stats->seen_next + 1) % INSTRUMENT_SEEN_MEMORIES;
+        }
+        return;
+    }
+
+    stats->buffers++;
+    stats->bytes += gst_buffer_get_size(buffer);
+    stats->memories += n;
+
+    if (buffer->pool != NULL)
+        stats->pooled++;
+
+    for (i = 0; i < n; i++) {
+        GstMemory* memory = gst_buffer_peek_memory(buffer, i);
+
+        if (memory->parent == NULL && !was_seen(stats, memory))
+            stats->allocated++;
+    }
+}
+
+static GstPadProbeReturn
+_instrument_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    ElementStats* stats = (ElementStats *) user_data;
+
+    g_mutex_lock(&stats->lock);
+
+    /* Named once it is in place, the bins are assembled after probing */
+    if (stats->path == NULL && GST_PAD_IS_SRC(pad))
+        stats->path = gst_object_get_path_string(GST_OBJECT_PARENT(pad));
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        count_buffer(stats, pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    else {
+        GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        guint i;
+
+        for (i = 0; i < gst_buffer_list_length(list); i++)
+            count_buffer(stats, pad, gst_buffer_list_get(list, i));
+    }
+
+    g_mutex_unlock(&stats->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+_instrument_pad_cb(GstElement* element, GstPad* pad, gpointer user_data)
+{
+    ElementStats* stats = (ElementStats *) user_data;
+
+    gst_pad_add_probe(pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER |
+            GST_PAD_PROBE_TYPE_BUFFER_LIST), _instrument_probe_cb,
+        element_stats_ref(stats), element_stats_unref);
+
+    return TRUE;
+}
+
+static void
+_instrument_pad_added_cb(GstElement* element, GstPad* pad, gpointer user_data)
+{
+    _instrument_pad_cb(element, pad, user_data);
+}
+
+static void
+instrument_element(GstElement* element)
+{
+    ElementStats* stats = NULL;
+
+    /* Bins only forward through ghost pads */
+    if (!options.instrument || GST_IS_BIN(element))
+        return;
+
+    /* A sink bin's children are seen again once it joins the stream bin */
+    if (g_object_get_data(G_OBJECT(element), "instrumented") != NULL)
+        return;
+
+    g_object_set_data(G_OBJECT(element), "instrumented",
+        GINT_TO_POINTER(TRUE));
+
+    stats = g_new0(ElementStats, 1);
+    stats->ref = 1;
+    g_mutex_init(&stats->lock);
+
+    gst_element_foreach_pad(element, _instrument_pad_cb, stats);
+
+    /* rtpptdemux and friends add their source pads later */
+    g_signal_connect_data(element, "pad-added",
+        G_CALLBACK(_instrument_pad_added_cb), element_stats_ref(stats),
+        (GClosureNotify) element_stats_unref, (GConnectFlags) 0);
+
+    g_mutex_lock(&app.instruments_lock);
+    g_ptr_array_add(app.instruments, stats);
+    g_mutex_unlock(&app.instruments_lock);
+}
+
+static void
+_instrument_element_cb(const GValue* value, gpointer user_data)
+{
+    instrument_element(GST_ELEMENT(g_value_get_object(value)));
+}
+
+static void
+_instrument_deep_element_added_cb(GstBin* bin, GstBin* sub_bin,
+    GstElement* element, gpointer user_data)
+{
+    instrument_element(element);
+}
+
+static void
+instrument_bin(GstElement* bin)
+{
+    GstIterator* it = NULL;
+
+    if (!options.instrument)
+        return;
+
+    it = gst_bin_iterate_recurse(GST_BIN(bin));
+    gst_iterator_foreach(it, _instrument_element_cb, NULL);
+    gst_iterator_free(it);
+
+    /* decodebin plugs its children once caps are known */
+    g_signal_connect(bin, "deep-element-added",
+        G_CALLBACK(_instrument_deep_element_added_cb), NULL);
+}
+
+static gboolean
+_instrument_report_cb(gpointer user_data)
+{
+    guint i;
+
+    g_mutex_lock(&app.instruments_lock);
+
+    for (i = 0; i < app.instruments->len;) {
+        ElementStats* stats =
+            (ElementStats *) g_ptr_array_index(app.instruments, i);
+
+        /* Only the registry is left, the element is gone */
+        if (g_atomic_int_get(&stats->ref) == 1) {
+            g_ptr_array_remove_index_fast(app.instruments, i);
+            continue;
+        }
+
+        g_mutex_lock(&stats->lock);
+
+        if (stats->buffers > 0) {
+            /* *INDENT-OFF* */
+            g_print("instrument %s: %" G_GUINT64_FORMAT " buffers/s, %"
+                G_GUINT64_FORMAT " bytes/s, %" G_GUINT64_FORMAT
+                " of %" G_GUINT64_FORMAT " memories allocated, pool hits %u%%\n",
+                stats->path,
+                stats->buffers,
+                stats->bytes,
+                stats->allocated,
+                stats->memories,
+                (guint) (stats->pooled * 100 / stats->buffers));
+            /* *INDENT-ON* */
+        }
+
+        stats->buffers = stats->bytes = stats->pooled = 0;
+        stats->memories = stats->allocated = 0;
+
+        g_mutex_unlock(&stats->lock);
+        i++;
+    }
+
+    g_mutex_unlock(&app.instruments_lock);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GstElement*
+build_sinkbin(const gchar* description, const gchar* name, GError** error)
+{
+    GstElement* sinkbin = NULL;
+
+    g_autoptr(GstElement) first = NULL;
+    g_autoptr(GstPad) qpad = NULL;
+    GstPad* gpad = NULL;
+
+    sinkbin = gst_parse_bin_from_description(description, FALSE, error);
+
+    if (sinkbin == NULL)
+        return NULL;
+
+    gst_object_set_name(GST_OBJECT(sinkbin), name);
+
+    first = gst_bin_get_by_name(GST_BIN(sinkbin), "q");
+    qpad = gst_element_get_static_pad(first, "sink");
+
+    gpad = gst_ghost_pad_new("sink", qpad);
+    gst_element_add_pad(sinkbin, gpad);
+
+    return sinkbin;
+}
+
+static GstElement*
+build_video_sinkbin(Stream* stream, guint pt, VideoCodec codec, GError** error)
+{
+    const VideoCodecInfo* info = &video_codecs[codec];
+    const VideoBranch* branch = &app.video[codec];
+    GstElement* sinkbin = NULL;
+
+    g_autoptr(GstElement) videosink = NULL;
+    g_autoptr(GstPad) vpad = NULL;
+    g_autoptr(GstElement) depay = NULL;
+    g_autoptr(GstPad) dpad = NULL;
+    g_autoptr(GstPad) dsinkpad = NULL;
+
+    g_autofree gchar* description = NULL;
+    g_autofree gchar* decode = NULL;
+    g_autofree gchar* record = NULL;
+    g_autofree gchar* sink = NULL;
+    g_autofree gchar* name = NULL;
+
+    /* --bench=transport measures everything up to the parser */
+    if (g_strcmp0(options.bench, "transport") == 0)
+        decode = g_strdup("");
+    else
+        decode = g_strdup_printf("%s%s ! %s%s", app.decode_queue,
+            branch->decoder,
+            branch->caps != NULL ? branch->caps : "",
+            branch->caps != NULL ? " ! " : "");
+
+    record = build_record_branch(info);
+
+    /* --multiview ends the branch in a queue in front of the compositor; the
+     * probes below know it as 'videosink' all the same */
+    if (options.bench != NULL)
+        sink = g_strdup("fakesink name=videosink sync=false async=true");
+    else if (app.compositor != NULL)
+        sink = g_strdup_printf("%s name=videosink", app.queue);
+    else
+        sink = g_strdup_printf("%s name=videosink async=true", branch->sink);
+
+    /* *INDENT-OFF* */
+    description =
+        g_strdup_printf
+        ("%s name=q ! %s%s name=depay ! %s ! %svalve name=render ! %s%s%s%s",
+            app.queue,
+            app.jitterbuffer,
+            info->depay,
+            info->parse,
+            options.record != NULL ? "tee name=rec ! " : "",
+            decode,
+            app.render_queue,
+            sink,
+            record);
+    /* *INDENT-ON* */
+
+    name = g_strdup_printf("video%u", pt);
+    sinkbin = build_sinkbin(description, name, error);
+
+    if (sinkbin == NULL)
+        return NULL;
+
+    if (app.compositor != NULL)
+        add_multiview_src(sinkbin);
+
+    configure_low_latency(sinkbin);
+
+    videosink = gst_bin_get_by_name(GST_BIN(sinkbin), "videosink");
+    vpad = gst_element_get_static_pad(videosink, "sink");
+    gst_pad_add_probe(vpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        _video_caps_probe_cb, NULL, NULL);
+    gst_pad_add_probe(vpad, GST_PAD_PROBE_TYPE_BUFFER,
+        _video_render_probe_cb, stream, NULL);
+    watch_startup(videosink, "sink", STARTUP_FIRST_FRAME);
+
+    depay = gst_bin_get_by_name(GST_BIN(sinkbin), "depay");
+    dpad = gst_element_get_static_pad(depay, "src");
+    gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER,
+        _video_depay_probe_cb, stream, NULL);
+
+    dsinkpad = gst_element_get_static_pad(depay, "sink");
+    gst_pad_add_probe(dsinkpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+        _force_key_unit_probe_cb, stream, NULL);
+
+    /* Frames before the first IDR, or after loss, can't be decoded; drop
+     * them here rather than in the parser or decoder. With the renumbering
+     * in front of rtpptdemux, a gap the depayloader sees is real loss. */
+    set_property_if_exists(depay, "wait-for-keyframe", "true");
+    if (options.feedback_port > 0)
+        set_property_if_exists(depay, "request-keyframe", "true");
+
+    bench_video_sinkbin(stream, sinkbin);
+    configure_recorder(sinkbin, stream, pt);
+    configure_overload(sinkbin, stream);
+
+    return sinkbin;
+}
+
+static GstElement*
+build_metadata_sinkbin(Stream* stream, guint pt, GError** error)
+{
+    GstElement* sinkbin = NULL;
+
+    g_autoptr(GstElement) depay = NULL;
+    g_autoptr(GstPad) dpad = NULL;
+    g_autoptr(GstElement) appsink = NULL;
+
+    g_autofree gchar* description = NULL;
+    g_autofree gchar* name = NULL;
+
+    GstAppSinkCallbacks callbacks = { NULL };
+
+    description =
+        g_strdup_printf
+        ("%s name=q ! %srtpgstdepay name=depay ! valve name=metadata ! appsink name=appsink sync=false max-buffers=%d drop=true",
+            app.queue, app.jitterbuffer, options.metadata_buffers);
+
+    name = g_strdup_printf("metadata%u", pt);
+    sinkbin = build_sinkbin(description, name, error);
+
+    if (sinkbin == NULL)
+        return NULL;
+
+    appsink = gst_bin_get_by_name(GST_BIN(sinkbin), "appsink");
+    callbacks.new_sample = _metadata_new_sample_cb;
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, stream, NULL);
+
+    depay = gst_bin_get_by_name(GST_BIN(sinkbin), "depay");
+    dpad = gst_element_get_static_pad(depay, "src");
+    gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER, _latency_probe_cb,
+        stream, NULL);
+
+    return sinkbin;
+}
+
+static GstElement*
+build_audio_sinkbin(Stream* stream, guint pt, AudioCodec codec, GError** error)
+{
+    const AudioCodecInfo* info = &audio_codecs[codec];
+    GstElement* sinkbin = NULL;
+
+    g_autofree gchar* description = NULL;
+    g_autofree gchar* name = NULL;
+
+    /* Same pipeline clock as the video sinks, so the two stay in sync */
+    description =
+        g_strdup_printf
+        ("%s name=q ! %s%s name=depay ! valve name=audio ! %s%s ! audioconvert ! audioresample ! %s%s name=audiosink",
+            app.queue, app.jitterbuffer, info->depay, app.decode_queue,
+            element_available(info->factory) ? info->decoder : "decodebin",
+            app.render_queue,
+            options.bench != NULL ? "fakesink sync=false" : app.audio_sink);
+
+    name = g_strdup_printf("audio%u", pt);
+    sinkbin = build_sinkbin(description, name, error);
+
+    if (sinkbin == NULL)
+        return NULL;
+
+    configure_low_latency(sinkbin);
+
+    return sinkbin;
+}
+
+static GstElement*
+build_discard_sinkbin(guint pt, GError** error)
+{
+    g_autofree gchar* description = NULL;
+    g_autofree gchar* name = NULL;
+
+    g_print("no sink for payload type %u (%s), discarding it\n", pt,
+        get_encoding_name(pt));
+
+    description = g_strdup_printf("%s name=q ! fakesink sync=false async=false",
+        app.queue);
+    name = g_strdup_printf("discard%u", pt);
+
+    return build_sinkbin(description, name, error);
+}
+
+static GstElement*
+build_payload_sinkbin(Stream* stream, guint pt, GError** error)
+{
+    gint codec = get_video_codec(pt);
+
+    if (codec >= 0)
+        return build_video_sinkbin(stream, pt, (VideoCodec) codec, error);
+
+    codec = get_audio_codec(pt);
+    if (codec >= 0)
+        return build_audio_sinkbin(stream, pt, (AudioCodec) codec, error);
+    if (g_strcmp0(get_encoding_name(pt), "X-GST") == 0)
+        return build_metadata_sinkbin(stream, pt, error);
+
+    return build_discard_sinkbin(pt, error);
+}
+
+static gboolean
+prebuild_sinkbin(Stream* stream, guint pt, GstElement* sinkbin)
+{
+    if (sinkbin == NULL)
+        return FALSE;
+
+    instrument_bin(sinkbin);
+    bench_threads(stream, sinkbin);
+
+    /* Opens the decoder and sink now rather than on the first packet */
+    gst_element_set_state(sinkbin, GST_STATE_READY);
+
+    g_hash_table_insert(stream->sinkbins, GUINT_TO_POINTER(pt),
+        gst_object_ref_sink(sinkbin));
+
+    return TRUE;
+}
+
+static GstPadProbeReturn
+_link_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    GstElement* sinkbin = GST_ELEMENT(user_data);
+
+    g_autoptr(GstElement) rtpdemux = NULL;
+    g_autoptr(GstPad) gpad = NULL;
+
+    g_print("pad link probe : %s\n", GST_PAD_NAME(pad));
+
+    /* Added on first use; after that the bin stays and only gets relinked */
+    if (GST_OBJECT_PARENT(sinkbin) == NULL) {
+        rtpdemux = gst_pad_get_parent_element(pad);
+        gst_bin_add(GST_BIN(GST_OBJECT_PARENT(rtpdemux)), sinkbin);
+    }
+
+    gpad = gst_element_get_static_pad(sinkbin, "sink");
+
+    if (gst_pad_link(pad, gpad) != GST_PAD_LINK_OK) {
+        g_error("failed to link pad to gpad");
+    }
+
+    gst_element_sync_state_with_parent(sinkbin);
+
+    if (app.compositor != NULL)
+        link_multiview(sinkbin);
+
+    g_print("linking done for %s\n", GST_ELEMENT_NAME(sinkbin));
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+_new_payload_type_cb(GstElement* element, guint pt, GstPad* pad,
+    gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+
+    GstElement* sinkbin = NULL;
+
+    g_print("new payload type pt: %d (stream %u)\n", pt, stream->id);
+
+    /* Everything was built up front; this only links */
+    sinkbin = (GstElement *) g_hash_table_lookup(stream->sinkbins,
+        GUINT_TO_POINTER(pt));
+
+    if (sinkbin != NULL)
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_IDLE, _link_cb, sinkbin, NULL);
+
+    /* Don't sit through the rest of the sender's GOP */
+    if (get_video_codec(pt) >= 0)
+        wait_for_keyframe(stream, "joined");
+}
+
+/**
+ * Section: Relay
+ *
+ * --relay forwards each input as it comes out of srtsrc, one SRT message
+ * per RTP packet, to every output. Nothing is parsed and the tee only
+ * hands the same buffers to each branch. Caller outputs carry the input's
+ * stream ID, so a listener downstream (this one included) can keep the
+ * feeds apart; listener outputs get the stream number added to their port,
+ * so every input has a port of its own.
+ *
+ * The tee passes on any error an output returns, which would stop srtsrc
+ * and every other output with it. So an output is marked failed from the
+ * sync bus handler, in the thread that posts the error, and a probe behind
+ * its valve drops everything from then on; the bus watch then restarts it.
+ */
+
+static gchar*
+build_relay_description(const gchar* source)
+{
+    GString* description = g_string_new(NULL);
+    guint i;
+
+    g_string_append_printf(description, "%s name=srtsrc ! tee name=relay",
+        source);
+
+    for (i = 0; options.relay[i] != NULL; i++) {
+        /* *INDENT-OFF* */
+        g_string_append_printf(description,
+            " relay. ! valve name=valve%u drop=true ! "
+            "queue name=relayq%u max-size-buffers=0 max-size-bytes=0 max-size-time=%"
+                G_GUINT64_FORMAT " leaky=downstream ! "
+            "srtsink name=relay%u sync=false async=false wait-for-connection=false",
+            i, i, (guint64) RELAY_QUEUE_TIME * GST_SECOND, i);
+        /* *INDENT-ON* */
+    }
+
+    return g_string_free(description, FALSE);
+}
+
+static void
+relay_output_free(gpointer data)
+{
+    RelayOutput* output = (RelayOutput *) data;
+
+    if (output->restart_source != 0)
+        g_source_remove(output->restart_source);
+
+    /* Locked, so the stream bin going to NULL leaves them alone */
+    gst_element_set_state(output->srtsink, GST_STATE_NULL);
+    gst_element_set_state(output->queue, GST_STATE_NULL);
+
+    g_object_set_data(G_OBJECT(output->srtsink), "relay-output", NULL);
+    g_object_set_data(G_OBJECT(output->queue), "relay-output", NULL);
+
+    gst_object_unref(output->srtsink);
+    gst_object_unref(output->queue);
+    gst_object_unref(output->valve);
+    g_free(output);
+}
+
+static GstPadProbeReturn
+_relay_valve_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    RelayOutput* output = (RelayOutput *) user_data;
+
+    /* The valve itself is only closed later, from the main loop */
+    if (g_atomic_int_get(&output->failed))
+        return GST_PAD_PROBE_DROP;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+mark_relay_failed(GstObject* object)
+{
+    RelayOutput* output =
+        (RelayOutput *) g_object_get_data(G_OBJECT(object), "relay-output");
+
+    if (output != NULL)
+        g_atomic_int_set(&output->failed, 1);
+}
+
+static RelayOutput*
+get_relay_output(GstElement* bin, guint i)
+{
+    RelayOutput* output = g_new0(RelayOutput, 1);
+    g_autofree gchar* valve = g_strdup_printf("valve%u", i);
+    g_autofree gchar* queue = g_strdup_printf("relayq%u", i);
+    g_autofree gchar* srtsink = g_strdup_printf("relay%u", i);
+
+    g_autoptr(GstPad) vpad = NULL;
+
+    output->valve = gst_bin_get_by_name(GST_BIN(bin), valve);
+    output->queue = gst_bin_get_by_name(GST_BIN(bin), queue);
+    output->srtsink = gst_bin_get_by_name(GST_BIN(bin), srtsink);
+    output->failed = 1;
+
+    /* One output that can't connect must not keep the input from starting */
+    gst_element_set_locked_state(output->queue, TRUE);
+    gst_element_set_locked_state(output->srtsink, TRUE);
+
+    /* For mark_relay_failed(), which can't walk the streams from a
+     * streaming thread */
+    g_object_set_data(G_OBJECT(output->srtsink), "relay-output", output);
+    g_object_set_data(G_OBJECT(output->queue), "relay-output", output);
+
+    vpad = gst_element_get_static_pad(output->valve, "src");
+    gst_pad_add_probe(vpad, GST_PAD_PROBE_TYPE_BUFFER, _relay_valve_probe_cb,
+        output, NULL);
+
+    return output;
+}
+
+static void
+start_relay_output(RelayOutput* output)
+{
+    /* A failure also posts an error, which schedules the next attempt */
+    if (gst_element_set_state(output->srtsink,
+            GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        return;
+
+    gst_element_set_state(output->queue, GST_STATE_PLAYING);
+    g_atomic_int_set(&output->failed, 0);
+    g_object_set(output->valve, "drop", FALSE, NULL);
+}
+
+static gboolean
+_relay_restart_cb(gpointer user_data)
+{
+    RelayOutput* output = (RelayOutput *) user_data;
+
+    output->restart_source = 0;
+    start_relay_output(output);
+
+    return G_SOURCE_REMOVE;
+}
+
+static RelayOutput*
+find_relay_output(Stream* stream, GstObject* object)
+{
+    guint i;
+
+    for (i = 0; i < stream->relays->len; i++) {
+        RelayOutput* output =
+            (RelayOutput *) g_ptr_array_index(stream->relays, i);
+
+        if (object == GST_OBJECT(output->srtsink)
+            || object == GST_OBJECT(output->queue))
+            return output;
+    }
+
+    return NULL;
+}
+
+static void
+schedule_relay_restart(RelayOutput* output)
+{
+    if (output->restart_source != 0)
+        return;
+
+    /* The tee keeps feeding the other outputs */
+    g_atomic_int_set(&output->failed, 1);
+    g_object_set(output->valve, "drop", TRUE, NULL);
+    gst_element_set_state(output->srtsink, GST_STATE_NULL);
+    gst_element_set_state(output->queue, GST_STATE_NULL);
+
+    output->restart_source =
+        g_timeout_add(RECONNECT_MAX_DELAY, _relay_restart_cb, output);
+}
+
+static gchar*
+get_relay_uri(const gchar* output, guint id)
+{
+    g_autoptr(GstUri) uri = gst_uri_from_string(output);
+    const gchar* mode = NULL;
+
+    if (uri == NULL)
+        return g_strdup(output);
+
+    mode = gst_uri_get_query_value(uri, "mode");
+
+    if (g_strcmp0(mode, "listener") == 0
+        || (mode == NULL && (gst_uri_get_host(uri) == NULL
+                || *gst_uri_get_host(uri) == '\0')))
+        gst_uri_set_port(uri, gst_uri_get_port(uri) + id);
+
+    return gst_uri_to_string(uri);
+}
+
+static void
+configure_relay(Stream* stream, const gchar* streamid)
+{
+    guint i;
+
+    for (i = 0; i < stream->relays->len; i++) {
+        RelayOutput* output =
+            (RelayOutput *) g_ptr_array_index(stream->relays, i);
+        g_autofree gchar* uri = get_relay_uri(options.relay[i], stream->id);
+
+        g_object_set(output->srtsink, "uri", uri, "streamid", streamid,
+            "latency", app.srt_latency, NULL);
+
+        g_print("stream %u: relaying to %s\n", stream->id, uri);
+        start_relay_output(output);
+    }
+}
+
+/**
+ * Section: Bonding
+ *
+ * --bond takes every URI as a path of the same feed, e.g. one per cellular
+ * link, with the sender broadcasting on all of them. Each path is an srtsrc
+ * of its own going into a funnel, and the RTP sequence number, per SSRC,
+ * drops whatever a faster path already delivered before rtpptdemux sees
+ * it. The paths are locked, so one whose link is down can't fail the
+ * pipeline's state change; each starts once the stream bin plays and, when
+ * it fails, is restarted after RECONNECT_MAX_DELAY while the others carry
+ * the stream, so failover is hitless. EOS from one path is not let through
+ * either.
+ */
+
+static void
+bond_path_free(gpointer data)
+{
+    BondPath* path = (BondPath *) data;
+
+    if (path->restart_source != 0)
+        g_source_remove(path->restart_source);
+
+    /* Locked, so the stream bin going to NULL leaves it alone */
+    gst_element_set_state(path->srtsrc, GST_STATE_NULL);
+
+    gst_object_unref(path->srtsrc);
+    g_free(path);
+}
+
+static BondPath*
+find_bond_path(Stream* stream, GstObject* object)
+{
+    guint i;
+
+    for (i = 0; i < stream->paths->len; i++) {
+        BondPath* path = (BondPath *) g_ptr_array_index(stream->paths, i);
+
+        if (object == GST_OBJECT(path->srtsrc))
+            return path;
+    }
+
+    return NULL;
+}
+
+static void
+start_bond_path(Stream* stream, BondPath* path)
+{
+    /* Started from the bus watch once the bin plays */
+    if (GST_STATE(stream->bin) != GST_STATE_PLAYING)
+        return;
+
+    /* The bin only hands its base time to children it changes state */
+    gst_element_set_base_time(path->srtsrc,
+        gst_element_get_base_time(stream->bin));
+
+    /* A failure also posts an error, which schedules the next attempt */
+    gst_element_set_state(path->srtsrc, GST_STATE_PLAYING);
+}
+
+static void
+start_bond_paths(Stream* stream)
+{
+    guint i;
+
+    for (i = 0; i < stream->paths->len; i++) {
+        BondPath* path = (BondPath *) g_ptr_array_index(stream->paths, i);
+
+        if (path->restart_source == 0
+            && GST_STATE(path->srtsrc) != GST_STATE_PLAYING)
+            start_bond_path(stream, path);
+    }
+}
+
+static gboolean
+_path_restart_cb(gpointer user_data)
+{
+    BondPath* path = (BondPath *) user_data;
+    Stream* stream = find_stream(GST_OBJECT(path->srtsrc));
+
+    path->restart_source = 0;
+
+    if (stream != NULL)
+        start_bond_path(stream, path);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_path_restart(Stream* stream, BondPath* path)
+{
+    if (path->restart_source != 0)
+        return;
+
+    g_print("stream %u: path %s down, retrying in %u ms\n", stream->id,
+        GST_ELEMENT_NAME(path->srtsrc), RECONNECT_MAX_DELAY);
+
+    gst_element_set_state(path->srtsrc, GST_STATE_NULL);
+    path->restart_source =
+        g_timeout_add(RECONNECT_MAX_DELAY, _path_restart_cb, path);
+}
+
+static GstPadProbeReturn
+_path_eos_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    GstElement* srtsrc = GST_ELEMENT(user_data);
+
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+        return GST_PAD_PROBE_OK;
+
+    /* Restarted from the main loop, like _srtsrc_probe_cb() does */
+    gst_element_post_message(srtsrc,
+        gst_message_new_application(GST_OBJECT(srtsrc),
+            gst_structure_new_empty("srt-path-down")));
+
+    return GST_PAD_PROBE_DROP;
+}
+
+static gboolean
+bond_seen(Stream* stream, guint32 ssrc, guint16 seq)
+{
+    BondWindow* window = (BondWindow *) g_hash_table_lookup(stream->bond_windows,
+        GUINT_TO_POINTER(ssrc));
+    gint16 delta;
+    gint i;
+
+    /* A new sender, or one that restarted; senders with an SSRC per payload
+     * type each get a window of their own */
+    if (window == NULL) {
+        if (g_hash_table_size(stream->bond_windows) >= RTP_SEQUENCE_MAX_SSRCS)
+            g_hash_table_remove_all(stream->bond_windows);
+
+        window = g_new0(BondWindow, 1);
+        window->max_seq = seq;
+        g_hash_table_insert(stream->bond_windows, GUINT_TO_POINTER(ssrc),
+            window);
+    }
+
+    delta = (gint16) (seq - window->max_seq);
+
+    if (delta > 0) {
+        /* Forget what falls out of the window */
+        for (i = 1; i <= MIN(delta, BOND_WINDOW); i++) {
+            guint16 old = window->max_seq + i;
+
+            window->seen[(old % BOND_WINDOW) / 32] &= ~(1u << (old % 32));
+        }
+
+        window->max_seq = seq;
+    }
+    else if (-delta >= BOND_WINDOW) {
+        return FALSE;
+    }
+
+    if (window->seen[(seq % BOND_WINDOW) / 32] & (1u << (seq % 32)))
+        return TRUE;
+
+    window->seen[(seq % BOND_WINDOW) / 32] |= 1u << (seq % 32);
+
+    return FALSE;
+}
+
+static GstPadProbeReturn
+_bond_dedup_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Stream* stream = (Stream *) user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    guint8 header[12];
+    guint32 ssrc;
+    guint16 seq;
+    gboolean duplicate;
+
+    /* Not RTP; rtpptdemux gets to complain about it */
+    if (gst_buffer_extract(buffer, 0, header, sizeof(header)) < sizeof(header)
+        || (header[0] >> 6) != 2)
+        return GST_PAD_PROBE_OK;
+
+    seq = (guint16) ((header[2] << 8) | header[3]);
+    ssrc = ((guint32) header[8] << 24) | ((guint32) header[9] << 16) |
+        ((guint32) header[10] << 8) | header[11];
+
+    /* Every path pushes from its own thread */
+    g_mutex_lock(&stream->bond_lock);
+    duplicate = bond_seen(stream, ssrc, seq);
+    if (duplicate)
+        stream->bond_duplicates++;
+    g_mutex_unlock(&stream->bond_lock);
+
+    return duplicate ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+static gchar*
+build_bond_source(guint paths)
+{
+    GString* source = g_string_new(NULL);
+    guint i;
+
+    /* build_stream() names the funnel 'srtsrc' */
+    for (i = 0; i < paths; i++)
+        g_string_append_printf(source, "srtsrc name=path%u ! srtsrc. ", i);
+
+    g_string_append(source, "funnel forward-sticky-events=false");
+
+    return g_string_free(source, FALSE);
+}
+
+static Stream*
+build_stream(const gchar* source, const gchar* uri, GError** error)
+{
+    Stream* stream = NULL;
+    GstElement* bin = NULL;
+    guint pt;
+
+    g_autoptr(GstPad) dpad = NULL;
+
+    g_autofree gchar* description = NULL;
+    g_autofree gchar* name = NULL;
+
+    if (options.relay != NULL)
+        description = build_relay_description(source);
+    else
+        description =
+            g_strdup_printf("%s name=srtsrc ! %s name=srcq ! rtpptdemux name=rtpdemux",
+                source, app.queue);
+
+    bin = gst_parse_bin_from_description(description, FALSE, error);
+
+    if (bin == NULL)
+        return NULL;
+
+    stream = g_new0(Stream, 1);
+    stream->id = app.next_stream_id++;
+    stream->uri = g_strdup(uri);
+    stream->sock = SRT_INVALID_SOCK;
+    stream->bin = (GstElement *) gst_object_ref_sink(bin);
+
+    g_mutex_init(&stream->latency_lock);
+    stream->last_video_pts = GST_CLOCK_TIME_NONE;
+    stream->pending_probes = g_array_new(FALSE, FALSE, sizeof(LatencyProbe));
+    stream->latency_samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+    g_mutex_init(&stream->bench_lock);
+    g_mutex_init(&stream->feedback_lock);
+    g_mutex_init(&stream->overload_lock);
+    stream->bench_thread_cpu = g_hash_table_new_full(g_direct_hash,
+        g_direct_equal, NULL, g_free);
+
+    g_mutex_init(&stream->metadata_lock);
+    stream->metadata_ring = g_new0(GstSample*, options.metadata_buffers);
+    stream->srtsrc = gst_bin_get_by_name(GST_BIN(bin), "srtsrc");
+    stream->rtpdemux = gst_bin_get_by_name(GST_BIN(bin), "rtpdemux");
+    watch_startup(stream->srtsrc, "src", STARTUP_CONNECT);
+    stream->sinkbins = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+        NULL, _sinkbin_free);
+    stream->sequences = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+        NULL, g_free);
+    stream->relays = g_ptr_array_new_with_free_func(relay_output_free);
+    stream->paths = g_ptr_array_new_with_free_func(bond_path_free);
+    stream->bond_windows = g_hash_table_new_full(g_direct_hash,
+        g_direct_equal, NULL, g_free);
+    g_mutex_init(&stream->bond_lock);
+
+    name = g_strdup_printf("stream%u", stream->id);
+    gst_object_set_name(GST_OBJECT(bin), name);
+
+    if (options.relay != NULL) {
+        for (pt = 0; options.relay[pt] != NULL; pt++)
+            g_ptr_array_add(stream->relays, get_relay_output(bin, pt));
+
+        instrument_bin(stream->bin);
+
+        return stream;
+    }
+
+    g_signal_connect(stream->rtpdemux, "new-payload-type", G_CALLBACK(_new_payload_type_cb), stream);
+    g_signal_connect(stream->rtpdemux, "request-pt-map", G_CALLBACK(_request_pt_map_cb), NULL);
+
+    /* Every packet is counted into the shared sequence before an unmapped
+     * one is dropped, or it would look like loss to the other types; the
+     * jitterbuffers behind rtpptdemux see the renumbered sequences */
+    dpad = gst_element_get_static_pad(stream->rtpdemux, "sink");
+    gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER, _renumber_probe_cb,
+        stream, NULL);
+    gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER, _pt_filter_cb, stream,
+        NULL);
+
+    instrument_bin(stream->bin);
+
+    /* srtsrc runs the receive thread, the queue behind it the demuxer */
+    if (options.bench != NULL) {
+        bench_thread(stream, stream->srtsrc);
+        bench_threads(stream, stream->bin);
+    }
+
+    for (pt = 0; pt < RTP_PAYLOAD_TYPES; pt++) {
+        if (app.pt_caps[pt] == NULL)
+            continue;
+
+        if (!prebuild_sinkbin(stream, pt, build_payload_sinkbin(stream, pt,
+                    error))) {
+            stream_free(stream);
+            return NULL;
+        }
+    }
+
+    return stream;
+}
+
+static Stream*
+build_recv_stream(const gchar* uri, const gchar* streamid, GError** error)
+{
+    Stream* stream = build_stream("srtsrc", uri, error);
+
+    if (stream == NULL)
+        return NULL;
+
+    g_object_set(stream->srtsrc, "uri", uri, "streamid", streamid,
+        "latency", app.srt_latency, NULL);
+
+    configure_relay(stream, streamid);
+    configure_feedback(stream);
+
+    if (options.reconnect)
+        watch_srtsrc(stream);
+
+    return stream;
+}
+
+static Stream*
+build_bond_stream(GPtrArray* uris, const gchar* streamid, GError** error)
+{
+    g_autofree gchar* source = build_bond_source(uris->len);
+    g_autoptr(GstPad) fpad = NULL;
+    Stream* stream = NULL;
+    guint i;
+
+    /* Messages and keyframe requests go by the first path */
+    stream = build_stream(source, (const gchar *) g_ptr_array_index(uris, 0),
+        error);
+
+    if (stream == NULL)
+        return NULL;
+
+    for (i = 0; i < uris->len; i++) {
+        const gchar* uri = (const gchar *) g_ptr_array_index(uris, i);
+        g_autofree gchar* name = g_strdup_printf("path%u", i);
+        g_autoptr(GstPad) pad = NULL;
+        BondPath* path = g_new0(BondPath, 1);
+
+        path->srtsrc = gst_bin_get_by_name(GST_BIN(stream->bin), name);
+        g_object_set(path->srtsrc, "uri", uri, "streamid", streamid,
+            "latency", app.srt_latency, NULL);
+
+        /* A path that can't connect must not keep the others from starting */
+        gst_element_set_locked_state(path->srtsrc, TRUE);
+
+        pad = gst_element_get_static_pad(path->srtsrc, "src");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+            _path_eos_probe_cb, path->srtsrc, NULL);
+
+        g_ptr_array_add(stream->paths, path);
+
+        g_print("stream %u: path %u from %s\n", stream->id, i, uri);
+    }
+
+    fpad = gst_element_get_static_pad(stream->srtsrc, "src");
+    gst_pad_add_probe(fpad, GST_PAD_PROBE_TYPE_BUFFER, _bond_dedup_probe_cb,
+        stream, NULL);
+
+    configure_relay(stream, streamid);
+    configure_feedback(stream);
+
+    return stream;
+}
+
+/**
+ * Listener:
+ *
+ * srtsrc serves a single caller in listener mode, so the listener socket is
+ * driven with libsrt directly instead. One thread waits on all sockets;
+ * every accepted caller gets its own stream bin, keyed by its stream ID,
+ * whose appsrc is fed the SRT messages as they arrive. A caller coming back
+ * with the same stream ID reuses the bin it had before, so its decoder and
+ * sink are already up.
+ */
+
+static struct
+{
+    SRTSOCKET sock;
+    gint epoll;
+    GThread* thread;
+    gint running;
+
+    /* SRTSOCKET -> appsrc, shared with the listener thread */
+    GMutex lock;
+    GHashTable* callers;
+} listener;
+
+typedef struct
+{
+    SRTSOCKET sock;
+    gchar* streamid;
+} Caller;
+
+static void
+caller_free(gpointer data)
+{
+    Caller* caller = (Caller *) data;
+
+    g_free(caller->streamid);
+    g_free(caller);
+}
+
+static Stream*
+find_listener_stream(const gchar* streamid)
+{
+    guint i;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+
+        if (stream->streamid != NULL && g_strcmp0(stream->streamid, streamid) == 0)
+            return stream;
+    }
+
+    return NULL;
+}
+
+static gboolean
+_caller_added_cb(gpointer user_data)
+{
+    Caller* caller = (Caller *) user_data;
+    Stream* stream = find_listener_stream(caller->streamid);
+
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar* uri = NULL;
+
+    gint events = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+
+    /* The newest caller wins; the old connection may just not have timed
+     * out yet when a sender comes back */
+    if (stream != NULL && stream->sock != SRT_INVALID_SOCK) {
+        g_print("caller '%s' replaced (stream %u)\n", caller->streamid,
+            stream->id);
+        listener_detach(stream);
+    }
+
+    if (stream == NULL) {
+        uri = g_strdup_printf("srt://:%d", options.listen_port);
+        stream = build_stream
+            ("appsrc is-live=true do-timestamp=true format=time caps=application/x-rtp",
+                uri, &error);
+
+        if (stream == NULL) {
+            g_printerr("%s\n", error->message);
+            srt_close(caller->sock);
+            return G_SOURCE_REMOVE;
+        }
+
+        stream->streamid = g_strdup(caller->streamid);
+        configure_relay(stream, stream->streamid);
+
+        gst_bin_add(GST_BIN(app.pipeline), stream->bin);
+        g_ptr_array_add(app.streams, stream);
+        gst_element_sync_state_with_parent(stream->bin);
+    }
+
+    g_print("caller '%s' connected (stream %u)\n", caller->streamid, stream->id);
+
+    stream->sock = caller->sock;
+
+    g_mutex_lock(&listener.lock);
+    g_hash_table_insert(listener.callers, GINT_TO_POINTER(stream->sock),
+        stream->srtsrc);
+    g_mutex_unlock(&listener.lock);
+
+    srt_epoll_add_usock(listener.epoll, stream->sock, &events);
+
+    /* A returning caller finds its sink bins already linked */
+    configure_feedback(stream);
+    wait_for_keyframe(stream, "caller connected");
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_caller_removed_cb(gpointer user_data)
+{
+    SRTSOCKET sock = GPOINTER_TO_INT(user_data);
+    guint i;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+
+        if (stream->sock == sock) {
+            g_print("caller '%s' disconnected (stream %u)\n", stream->streamid,
+                stream->id);
+            stream->sock = SRT_INVALID_SOCK;
+            break;
+        }
+    }
+
+    srt_close(sock);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+listener_detach(Stream* stream)
+{
+    srt_epoll_remove_usock(listener.epoll, stream->sock);
+
+    g_mutex_lock(&listener.lock);
+    g_hash_table_remove(listener.callers, GINT_TO_POINTER(stream->sock));
+    g_mutex_unlock(&listener.lock);
+
+    srt_close(stream->sock);
+    stream->sock = SRT_INVALID_SOCK;
+}
+
+static int
+_listen_cb(void* opaque, SRTSOCKET sock, int hs_version,
+    const struct sockaddr* peer, const char* streamid)
+{
+    g_autofree gchar* u = NULL;
+    g_autofree gchar* r = NULL;
+
+    /* Without -u/-r every caller is welcome */
+    if (options.user == NULL && options.resource == NULL)
+        return 0;
+
+    if (!parse_streamid(streamid, &u, &r))
+        return -1;
+
+    if (options.user != NULL && g_strcmp0(options.user, u) != 0)
+        return -1;
+
+    if (options.resource != NULL && g_strcmp0(options.resource, r) != 0)
+        return -1;
+
+    return 0;
+}
+
+static void
+listener_accept(void)
+{
+    Caller* caller = NULL;
+    SRTSOCKET sock;
+
+    struct sockaddr_storage peer;
+    gint peer_len = sizeof(peer);
+
+    gchar streamid[512];
+    gint streamid_len = sizeof(streamid);
+
+    sock = srt_accept(listener.sock, (struct sockaddr *) &peer, &peer_len);
+    if (sock == SRT_INVALID_SOCK)
+        return;
+
+    if (srt_getsockflag(sock, SRTO_STREAMID, streamid, &streamid_len) == SRT_ERROR)
+        streamid_len = 0;
+
+    caller = g_new0(Caller, 1);
+    caller->sock = sock;
+    caller->streamid = g_strndup(streamid, streamid_len);
+
+    /* Streams are created and owned by the main loop */
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, _caller_added_cb,
+        caller, caller_free);
+}
+
+static void
+listener_receive(SRTSOCKET sock)
+{
+    GstElement* appsrc = NULL;
+    gint len;
+
+    g_mutex_lock(&listener.lock);
+    appsrc = (GstElement *) g_hash_table_lookup(listener.callers,
+        GINT_TO_POINTER(sock));
+    if (appsrc != NULL)
+        gst_object_ref(appsrc);
+    g_mutex_unlock(&listener.lock);
+
+    if (appsrc == NULL)
+        return;
+
+    /* Drain everything that is ready; one SRT message is one RTP packet */
+    for (;;) {
+        GstBuffer* buffer = gst_buffer_new_allocate(NULL, SRT_LIVE_MAX_PLSIZE, NULL);
+        GstMapInfo map;
+
+        gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+        len = srt_recvmsg(sock, (char *) map.data, (int) map.size);
+        gst_buffer_unmap(buffer, &map);
+
+        if (len <= 0) {
+            gst_buffer_unref(buffer);
+            break;
+        }
+
+        gst_buffer_set_size(buffer, len);
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+    }
+
+    gst_object_unref(appsrc);
+
+    if (len == SRT_ERROR && srt_getlasterror(NULL) == SRT_EASYNCRCV)
+        return;
+
+    /* Broken or closed by the peer */
+    srt_epoll_remove_usock(listener.epoll, sock);
+
+    g_mutex_lock(&listener.lock);
+    g_hash_table_remove(listener.callers, GINT_TO_POINTER(sock));
+    g_mutex_unlock(&listener.lock);
+
+    g_main_context_invoke(NULL, _caller_removed_cb, GINT_TO_POINTER(sock));
+}
+
+static gpointer
+listener_thread_func(gpointer data)
+{
+    SRT_EPOLL_EVENT events[16];
+    gint n, i;
+
+    while (g_atomic_int_get(&listener.running)) {
+        n = srt_epoll_uwait(listener.epoll, events, G_N_ELEMENTS(events), 100);
+
+        for (i = 0; i < n; i++) {
+            if (events[i].fd == listener.sock)
+                listener_accept();
+            else
+                listener_receive(events[i].fd);
+        }
+    }
+
+    return NULL;
+}
+
+static gboolean
+start_listener(gint port, GError** error)
+{
+    struct sockaddr_in sa;
+    gint no = 0;
+    gint events = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+
+    srt_startup();
+
+    listener.sock = srt_create_socket();
+
+    /* Non-blocking; accepted sockets inherit it as well as the latency */
+    srt_setsockflag(listener.sock, SRTO_RCVSYN, &no, sizeof(no));
+    srt_setsockflag(listener.sock, SRTO_RCVLATENCY, &app.srt_latency,
+        sizeof(app.srt_latency));
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = INADDR_ANY;
+
+    if (srt_bind(listener.sock, (struct sockaddr *) &sa, sizeof(sa)) == SRT_ERROR
+        || srt_listen_callback(listener.sock, _listen_cb, NULL) == SRT_ERROR
+        || srt_listen(listener.sock, 32) == SRT_ERROR) {
+        g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_OPEN_READ,
+            "Failed to listen on port %d: %s", port, srt_getlasterror_str());
+        srt_close(listener.sock);
+        return FALSE;
+    }
+
+    listener.epoll = srt_epoll_create();
+    srt_epoll_add_usock(listener.epoll, listener.sock, &events);
+
+    g_mutex_init(&listener.lock);
+    listener.callers = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    g_atomic_int_set(&listener.running, TRUE);
+    listener.thread = g_thread_new("srt-listener", listener_thread_func, NULL);
+
+    g_print("listening on port %d\n", port);
+
+    return TRUE;
+}
+
+static void
+stop_listener(void)
+{
+    g_atomic_int_set(&listener.running, FALSE);
+    g_thread_join(listener.thread);
+
+    srt_epoll_release(listener.epoll);
+    srt_close(listener.sock);
+
+    g_hash_table_unref(listener.callers);
+    g_mutex_clear(&listener.lock);
+
+    srt_cleanup();
+}
+
+typedef struct
+{
+    guint id;
+
+    /* source ! encoder ! pay ! rtpmux ! srtsink, plus the metadata appsrc */
+    GstElement* bin;
+    GstElement* srtsink;
+    GstElement* metasrc;
+    GstElement* encoder;
+    gint64 last_probe;
+
+    /* --feedback-port: keyframe requests from the receivers */
+    UdpSocket feedback;
+    GThread* feedback_thread;
+    gint feedback_running;
+    gint64 last_keyframe;
+
+    /* --abr: what the encoder is currently set to, in kbit/s */
+    gint bitrate;
+} Sender;
+
+static struct
+{
+    const VideoEncoder* encoder;
+
+    /* One for --send, one per stream for --loopback */
+    GPtrArray* senders;
+} sender;
+
+/**
+ * Statistics:
+ *
+ * Every few seconds the SRT statistics of each stream are written as one
+ * JSON object per line. srtsrc streams report its 'stats' property as is;
+ * listener streams are read with srt_bstats() and use the same field names.
+ */
+
+static gint64
+get_stats_int(const GstStructure* stats, const gchar* name)
+{
+    gint64 v64 = 0;
+    guint64 u64 = 0;
+    gint v = 0;
+
+    if (gst_structure_get_int64(stats, name, &v64))
+        return v64;
+    if (gst_structure_get_uint64(stats, name, &u64))
+        return (gint64) u64;
+    if (gst_structure_get_int(stats, name, &v))
+        return v;
+
+    return 0;
+}
+
+static gdouble
+get_stats_double(const GstStructure* stats, const gchar* name)
+{
+    gdouble v = 0;
+
+    gst_structure_get_double(stats, name, &v);
+
+    return v;
+}
+
+static GstStructure*
+get_srtsrc_stats(GstElement* srtsrc)
+{
+    GstStructure* stats = NULL;
+    const GValue* callers;
+    const GValue* caller;
+    GstStructure* first = NULL;
+
+    g_object_get(srtsrc, "stats", &stats, NULL);
+
+    if (stats == NULL)
+        return NULL;
+
+    /* In listener mode the counters are per caller, and srtsrc serves one */
+    callers = gst_structure_get_value(stats, "callers");
+    if (callers == NULL || !GST_VALUE_HOLDS_ARRAY(callers)
+        || gst_value_array_get_size(callers) == 0)
+        return stats;
+
+    caller = gst_value_array_get_value(callers, 0);
+    if (GST_VALUE_HOLDS_STRUCTURE(caller))
+        first = gst_structure_copy(gst_value_get_structure(caller));
+
+    if (first == NULL)
+        return stats;
+
+    gst_structure_free(stats);
+
+    return first;
+}
+
+static GstStructure*
+get_bond_stats(Stream* stream)
+{
+    gint64 packets = 0, lost = 0, retransmitted = 0, dropped = 0, bytes = 0;
+    gdouble rate = 0, bandwidth = 0, rtt = 0;
+    guint i;
+
+    /* Paths add up, except for the round trip where the worst one counts */
+    for (i = 0; i < stream->paths->len; i++) {
+        BondPath* path = (BondPath *) g_ptr_array_index(stream->paths, i);
+        GstStructure* stats = NULL;
+
+        stats = get_srtsrc_stats(path->srtsrc);
+        if (stats == NULL)
+            continue;
+
+        packets += get_stats_int(stats, "packets-received");
+        lost += get_stats_int(stats, "packets-received-lost");
+        retransmitted += get_stats_int(stats, "packets-received-retransmitted");
+        dropped += get_stats_int(stats, "packets-received-dropped");
+        bytes += get_stats_int(stats, "bytes-received");
+        rate += get_stats_double(stats, "receive-rate-mbps");
+        bandwidth += get_stats_double(stats, "bandwidth-mbps");
+        rtt = MAX(rtt, get_stats_double(stats, "rtt-ms"));
+
+        gst_structure_free(stats);
+    }
+
+    /* *INDENT-OFF* */
+    return gst_structure_new("application/x-srt-statistics",
+        "packets-received", G_TYPE_INT64, packets,
+        "packets-received-lost", G_TYPE_INT, (gint) lost,
+        "packets-received-retransmitted", G_TYPE_INT, (gint) retransmitted,
+        "packets-received-dropped", G_TYPE_INT, (gint) dropped,
+        "bytes-received", G_TYPE_UINT64, (guint64) bytes,
+        "receive-rate-mbps", G_TYPE_DOUBLE, rate,
+        "bandwidth-mbps", G_TYPE_DOUBLE, bandwidth,
+        "rtt-ms", G_TYPE_DOUBLE, rtt,
+        NULL);
+    /* *INDENT-ON* */
+}
+
+static GstStructure*
+get_stream_stats(Stream* stream)
+{
+    SRT_TRACEBSTATS perf;
+
+    if (stream->paths->len > 0)
+        return get_bond_stats(stream);
+
+    if (stream->streamid == NULL)
+        return get_srtsrc_stats(stream->srtsrc);
+
+    if (stream->sock == SRT_INVALID_SOCK
+        || srt_bstats(stream->sock, &perf, 0) == SRT_ERROR)
+        return gst_structure_new_empty("application/x-srt-statistics");
+
+    /* *INDENT-OFF* */
+    return gst_structure_new("application/x-srt-statistics",
+        "packets-received", G_TYPE_INT64, (gint64) perf.pktRecvTotal,
+        "packets-received-lost", G_TYPE_INT, perf.pktRcvLossTotal,
+        "packets-received-retransmitted", G_TYPE_INT, perf.pktRcvRetransTotal,
+        "packets-received-dropped", G_TYPE_INT, perf.pktRcvDropTotal,
+        "bytes-received", G_TYPE_UINT64, (guint64) perf.byteRecvTotal,
+        "receive-rate-mbps", G_TYPE_DOUBLE, perf.mbpsRecvRate,
+        "bandwidth-mbps", G_TYPE_DOUBLE, perf.mbpsBandwidth,
+        "rtt-ms", G_TYPE_DOUBLE, perf.msRTT,
+        "receive-buffer-ms", G_TYPE_INT, perf.msRcvBuf,
+        "negotiated-latency-ms", G_TYPE_INT, perf.msRcvTsbPdDelay,
+        NULL);
+    /* *INDENT-ON* */
+}
+
+static gboolean
+_feedback_report_cb(gpointer user_data)
+{
+    guint i;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+        GstStructure* stats = NULL;
+        GstStructure* report = NULL;
+        g_autofree gchar* text = NULL;
+        struct sockaddr_in addr;
+        gboolean has_addr;
+        gint64 packets, lost, dropped;
+        gdouble rate = 0, bandwidth = 0;
+
+        g_mutex_lock(&stream->feedback_lock);
+        addr = stream->feedback_addr;
+        has_addr = stream->has_feedback_addr;
+        g_mutex_unlock(&stream->feedback_lock);
+
+        if (!has_addr)
+            continue;
+
+        stats = get_stream_stats(stream);
+        if (stats == NULL)
+            continue;
+
+        packets = get_stats_int(stats, "packets-received");
+        lost = get_stats_int(stats, "packets-received-lost");
+        dropped = get_stats_int(stats, "packets-received-dropped");
+        gst_structure_get_double(stats, "receive-rate-mbps", &rate);
+        gst_structure_get_double(stats, "bandwidth-mbps", &bandwidth);
+
+        /* Totals start over with a new connection */
+        if (packets < stream->reported_packets) {
+            stream->reported_packets = 0;
+            stream->reported_lost = 0;
+            stream->reported_dropped = 0;
+        }
+
+        report = gst_structure_new("congestion",
+            "packets", G_TYPE_INT64, packets - stream->reported_packets,
+            "lost", G_TYPE_INT64, MAX(lost - stream->reported_lost, 0),
+            "dropped", G_TYPE_INT64, MAX(dropped - stream->reported_dropped, 0),
+            "rate-kbps", G_TYPE_INT, (gint) (rate * 1000),
+            "bandwidth-kbps", G_TYPE_INT, (gint) (bandwidth * 1000), NULL);
+
+        stream->reported_packets = packets;
+        stream->reported_lost = lost;
+        stream->reported_dropped = dropped;
+
+        text = gst_structure_to_string(report);
+        send_feedback(&addr, text);
+
+        gst_structure_free(report);
+        gst_structure_free(stats);
+    }
+
+    return TRUE;
+}
+
+static void
+append_json_string(GString* json, const gchar* str)
+{
+    const gchar* p;
+
+    g_string_append_c(json, '"');
+
+    for (p = str; p != NULL && *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\')
+            g_string_append_printf(json, "\\%c", *p);
+        else if ((guchar) *p < 0x20)
+            g_string_append_printf(json, "\\u%04x", (guchar) *p);
+        else
+            g_string_append_c(json, *p);
+    }
+
+    g_string_append_c(json, '"');
+}
+
+static void append_json_structure(GString* json, const GstStructure* s);
+
+static void
+append_json_value(GString* json, const GValue* value)
+{
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    guint i;
+
+    if (G_VALUE_HOLDS_INT(value))
+        g_string_append_printf(json, "%d", g_value_get_int(value));
+    else if (G_VALUE_HOLDS_UINT(value))
+        g_string_append_printf(json, "%u", g_value_get_uint(value));
+    else if (G_VALUE_HOLDS_INT64(value))
+        g_string_append_printf(json, "%" G_GINT64_FORMAT, g_value_get_int64(value));
+    else if (G_VALUE_HOLDS_UINT64(value))
+        g_string_append_printf(json, "%" G_GUINT64_FORMAT, g_value_get_uint64(value));
+    else if (G_VALUE_HOLDS_DOUBLE(value))
+        g_string_append(json, g_ascii_formatd(buf, sizeof(buf), "%.3f",
+                g_value_get_double(value)));
+    else if (G_VALUE_HOLDS_BOOLEAN(value))
+        g_string_append(json, g_value_get_boolean(value) ? "true" : "false");
+    else if (G_VALUE_HOLDS_STRING(value))
+        append_json_string(json, g_value_get_string(value));
+    else if (GST_VALUE_HOLDS_STRUCTURE(value))
+        append_json_structure(json, gst_value_get_structure(value));
+    else if (GST_VALUE_HOLDS_ARRAY(value)) {
+        /* SRT elements in listener mode report one structure per caller */
+        g_string_append_c(json, '[');
+        for (i = 0; i < gst_value_array_get_size(value); i++) {
+            if (i > 0)
+                g_string_append_c(json, ',');
+            append_json_value(json, gst_value_array_get_value(value, i));
+        }
+        g_string_append_c(json, ']');
+    }
+    else
+        g_string_append(json, "null");
+}
+
+static gboolean
+_append_json_field_cb(GQuark field, const GValue* value, gpointer user_data)
+{
+    GString* json = (GString *) user_data;
+
+    if (json->str[json->len - 1] != '{')
+        g_string_append_c(json, ',');
+
+    append_json_string(json, g_quark_to_string(field));
+    g_string_append_c(json, ':');
+    append_json_value(json, value);
+
+    return TRUE;
+}
+
+static void
+append_json_structure(GString* json, const GstStructure* s)
+{
+    g_string_append_c(json, '{');
+    if (s != NULL)
+        gst_structure_foreach(s, _append_json_field_cb, json);
+    g_string_append_c(json, '}');
+}
+
+static void
+append_stats(GString* report)
+{
+    gint64 now = g_get_real_time() / 1000;
+    guint i;
+
+    guint count;
+    gdouble p50, p99;
+    guint64 metadata_dropped;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+        GstStructure* stats = get_stream_stats(stream);
+
+        g_string_append_printf(report,
+            "{\"timestamp-ms\":%" G_GINT64_FORMAT ",\"stream\":%u,\"uri\":",
+            now, stream->id);
+        append_json_string(report, stream->uri);
+
+        if (stream->streamid != NULL) {
+            g_string_append(report, ",\"streamid\":");
+            append_json_string(report, stream->streamid);
+        }
+
+        g_string_append(report, ",\"srt\":");
+        append_json_structure(report, stats);
+
+        g_mutex_lock(&stream->metadata_lock);
+        metadata_dropped = stream->metadata_dropped;
+        g_mutex_unlock(&stream->metadata_lock);
+
+        if (metadata_dropped > 0)
+            g_string_append_printf(report, ",\"metadata-dropped\":%" G_GUINT64_FORMAT,
+                metadata_dropped);
+
+        if (stream->reconnects > 0)
+            g_string_append_printf(report, ",\"reconnects\":%u", stream->reconnects);
+
+        if (stream->paths->len > 0) {
+            g_mutex_lock(&stream->bond_lock);
+            g_string_append_printf(report, ",\"bond\":{\"paths\":%u,"
+                "\"duplicates\":%" G_GUINT64_FORMAT "}", stream->paths->len,
+                stream->bond_duplicates);
+            g_mutex_unlock(&stream->bond_lock);
+        }
+
+        g_mutex_lock(&stream->overload_lock);
+        if (options.overload_policy != OVERLOAD_NONE || stream->qos_dropped > 0)
+            g_string_append_printf(report, ",\"overload\":{\"level\":\"%s\","
+                "\"dropped\":%" G_GUINT64_FORMAT ",\"sink-dropped\":%"
+                G_GUINT64_FORMAT "}", overload_levels[stream->overload_level],
+                stream->overload_dropped, stream->qos_dropped);
+        g_mutex_unlock(&stream->overload_lock);
+
+        if (g_atomic_int_get(&stream->unknown_pt_dropped) > 0)
+            g_string_append_printf(report, ",\"unknown-pt-dropped\":%d",
+                g_atomic_int_get(&stream->unknown_pt_dropped));
+
+        if (g_atomic_int_get(&stream->short_dropped) > 0)
+            g_string_append_printf(report, ",\"short-dropped\":%d",
+                g_atomic_int_get(&stream->short_dropped));
+
+        if (get_latency_percentiles(stream, &count, &p50, &p99)) {
+            gchar p50_str[G_ASCII_DTOSTR_BUF_SIZE];
+            gchar p99_str[G_ASCII_DTOSTR_BUF_SIZE];
+
+            g_string_append_printf(report,
+                ",\"latency\":{\"samples\":%u,\"p50-ms\":%s,\"p99-ms\":%s}",
+                count,
+                g_ascii_formatd(p50_str, sizeof(p50_str), "%.1f", p50),
+                g_ascii_formatd(p99_str, sizeof(p99_str), "%.1f", p99));
+        }
+
+        g_string_append(report, "}\n");
+
+        if (stats != NULL)
+            gst_structure_free(stats);
+    }
+
+    for (i = 0; sender.senders != NULL && i < sender.senders->len; i++) {
+        Sender* s = (Sender *) g_ptr_array_index(sender.senders, i);
+        GstStructure* stats = NULL;
+
+        g_object_get(s->srtsink, "stats", &stats, NULL);
+
+        g_string_append_printf(report, "{\"timestamp-ms\":%" G_GINT64_FORMAT
+            ",\"sender\":true,\"stream\":%u,\"srt\":", now, s->id);
+        append_json_structure(report, stats);
+        g_string_append(report, "}\n");
+
+        if (stats != NULL)
+            gst_structure_free(stats);
+    }
+
+}
+
+static gboolean
+_stats_cb(gpointer user_data)
+{
+    GString* report = g_string_new(NULL);
+
+    append_stats(report);
+
+    fputs(report->str, app.stats);
+    fflush(app.stats);
+
+    g_string_free(report, TRUE);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Sender:
+ *
+ * The pipeline from the diagram above; the video source is encoded with the
+ * selected H.264 encoder and the X-GST payload carries latency probes.
+ */
+
+static const VideoEncoder*
+select_video_encoder(const gchar* name)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(video_encoders); i++) {
+        const VideoEncoder* entry = &video_encoders[i];
+
+        if (name == NULL && !entry->hardware && i + 1 < G_N_ELEMENTS(video_encoders))
+            continue;
+
+        if (name != NULL && g_strcmp0(name, entry->name) != 0)
+            continue;
+
+        if (element_available(entry->encoder))
+            return entry;
+
+        if (name != NULL)
+            g_printerr("%s is not available, falling back to x264enc\n",
+                entry->encoder);
+        break;
+    }
+
+    /* x264enc is the last entry */
+    return &video_encoders[G_N_ELEMENTS(video_encoders) - 1];
+}
+
+static void
+configure_video_encoder(GstElement* encoder, const VideoEncoder* entry)
+{
+    g_autofree gchar* bitrate = NULL;
+    g_autofree gchar* gop = NULL;
+    guint i;
+
+    for (i = 0; entry->settings[i] != NULL; i += 2)
+        set_property_if_exists(encoder, entry->settings[i], entry->settings[i + 1]);
+
+    /* All of them take kbit/s */
+    bitrate = g_strdup_printf("%d", options.bitrate);
+    set_property_if_exists(encoder, "bitrate", bitrate);
+
+    gop = g_strdup_printf("%d", options.gop);
+    set_property_if_exists(encoder, "gop-size", gop);
+    set_property_if_exists(encoder, "key-int-max", gop);
+}
+
+static GstPadProbeReturn
+_encoder_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    Sender* s = (Sender *) user_data;
+    gint64 now = g_get_monotonic_time();
+    g_autofree gchar* text = NULL;
+
+    if (now - s->last_probe < LATENCY_PROBE_INTERVAL)
+        return GST_PAD_PROBE_OK;
+
+    s->last_probe = now;
+
+    /* Goes out ahead of this frame, which is still to be encoded */
+    text = g_strdup_printf(LATENCY_PROBE_PREFIX "%" G_GINT64_FORMAT,
+        g_get_real_time());
+    gst_app_src_push_buffer(GST_APP_SRC(s->metasrc),
+        gst_buffer_new_memdup(text, strlen(text)));
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+force_keyframe(Sender* s, const struct sockaddr_in* peer)
+{
+    gint64 now = g_get_monotonic_time();
+    gchar addr[INET_ADDRSTRLEN] = "";
+
+    /* Several receivers, or a relay's, ask after the same loss */
+    if (now - s->last_keyframe < KEYFRAME_REQUEST_INTERVAL * 1000)
+        return;
+
+    s->last_keyframe = now;
+
+    /* inet_ntoa() is deprecated, and an error with MSVC's SDL checks */
+    inet_ntop(AF_INET, &peer->sin_addr, addr, sizeof(addr));
+    g_print("sender %u: keyframe requested by %s\n", s->id, addr);
+
+    /* gst_video_event_new_upstream_force_key_unit(), without linking
+     * gstvideo for it */
+    gst_element_send_event(s->encoder,
+        gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM,
+            gst_structure_new("GstForceKeyUnit",
+                "running-time", G_TYPE_UINT64, GST_CLOCK_TIME_NONE,
+                "all-headers", G_TYPE_BOOLEAN, TRUE,
+                "count", G_TYPE_UINT, 0, NULL)));
+}
+
+static void
+adapt_bitrate(Sender* s, const GstStructure* report)
+{
+    gint64 packets = 0, lost = 0, dropped = 0;
+    gint bandwidth = 0;
+    gint min_bitrate = MAX(options.bitrate / ABR_MIN_BITRATE_DIVISOR, 1);
+    gint bitrate = s->bitrate;
+    gdouble loss;
+
+    gst_structure_get_int64(report, "packets", &packets);
+    gst_structure_get_int64(report, "lost", &lost);
+    gst_structure_get_int64(report, "dropped", &dropped);
+    gst_structure_get_int(report, "bandwidth-kbps", &bandwidth);
+
+    /* Nothing arrived; that's for the reconnect logic, not the encoder */
+    if (packets + lost == 0)
+        return;
+
+    loss = 100.0 * lost / (packets + lost);
+
+    if (dropped > 0 || loss >= ABR_LOSS_HIGH)
+        bitrate = (gint) (bitrate * ABR_DECREASE);
+    else if (loss < ABR_LOSS_LOW)
+        bitrate += (gint) (options.bitrate * ABR_INCREASE_STEP);
+
+    /* Retransmissions have to fit next to the stream */
+    if (bandwidth > 0)
+        bitrate = MIN(bitrate, (gint) (bandwidth * ABR_HEADROOM));
+
+    bitrate = CLAMP(bitrate, min_bitrate, options.bitrate);
+
+    if (bitrate == s->bitrate)
+        return;
+
+    g_print("sender %u: bitrate %d -> %d kbit/s (loss %.1f%%, dropped %"
+        G_GINT64_FORMAT ", bandwidth %d kbit/s)\n", s->id, s->bitrate, bitrate,
+        loss, dropped, bandwidth);
+
+    s->bitrate = bitrate;
+
+    {
+        g_autofree gchar* value = g_strdup_printf("%d", bitrate);
+
+        set_property_if_exists(s->encoder, "bitrate", value);
+    }
+}
+
+static gpointer
+feedback_thread_func(gpointer data)
+{
+    Sender* s = (Sender *) data;
+    gchar buf[512];
+
+    while (g_atomic_int_get(&s->feedback_running)) {
+        struct timeval tv = { 0, 100 * 1000 };
+        struct sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        GstStructure* message = NULL;
+        fd_set set;
+        int n;
+
+        FD_ZERO(&set);
+        FD_SET(s->feedback, &set);
+
+        /* Wakes up now and then to check 'feedback_running' */
+        if (select((int) s->feedback + 1, &set, NULL, NULL, &tv) <= 0)
+            continue;
+
+        n = recvfrom(s->feedback, buf, sizeof(buf) - 1, 0,
+            (struct sockaddr *) &peer, &len);
+        if (n <= 0)
+            continue;
+
+        buf[n] = '\0';
+        message = gst_structure_from_string(buf, NULL);
+        if (message == NULL)
+            continue;
+
+        if (gst_structure_has_name(message, KEYFRAME_REQUEST))
+            force_keyframe(s, &peer);
+        else if (gst_structure_has_name(message, "congestion") && options.abr)
+            adapt_bitrate(s, message);
+
+        gst_structure_free(message);
+    }
+
+    return NULL;
+}
+
+static void
+start_feedback(Sender* s)
+{
+    gint port = options.feedback_port + s->id;
+    struct sockaddr_in sa;
+
+    s->feedback = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s->feedback == INVALID_SOCKET)
+        return;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(port);
+
+    if (bind(s->feedback, (struct sockaddr *) &sa, sizeof(sa)) != 0) {
+        g_printerr("sender %u: can't take feedback on port %d\n",
+            s->id, port);
+        close_udp_socket(s->feedback);
+        s->feedback = INVALID_SOCKET;
+        return;
+    }
+
+    g_atomic_int_set(&s->feedback_running, 1);
+    s->feedback_thread = g_thread_new("feedback", feedback_thread_func, s);
+}
+
+static void
+sender_free(Sender* s)
+{
+    if (s->feedback_thread != NULL) {
+        g_atomic_int_set(&s->feedback_running, 0);
+        g_thread_join(s->feedback_thread);
+    }
+
+    if (s->feedback != INVALID_SOCKET)
+        close_udp_socket(s->feedback);
+
+    gst_object_unref(s->encoder);
+    gst_object_unref(s->metasrc);
+    gst_object_unref(s->srtsink);
+    gst_object_unref(s->bin);
+    g_free(s);
+}
+
+static Sender*
+build_sender(const gchar* uri, const gchar* streamid, GError** error)
+{
+    Sender* s = NULL;
+    GstElement* bin = NULL;
+
+    g_autoptr(GstPad) epad = NULL;
+
+    g_autofree gchar* description = NULL;
+    g_autofree gchar* name = NULL;
+
+    if (sender.encoder == NULL) {
+        sender.encoder = select_video_encoder(options.encoder);
+        g_print("video encoder: %s\n", sender.encoder->encoder);
+    }
+
+    /* *INDENT-OFF* */
+    description =
+        g_strdup_printf
+        ("%s ! videoconvert ! %s name=encoder ! h264parse ! "
+            "rtph264pay pt=96 config-interval=-1 ! mux.sink_0 "
+         "appsrc name=metasrc is-live=true do-timestamp=true format=time caps=text/x-raw,format=utf8 ! "
+            "rtpgstpay pt=99 ! mux.sink_1 "
+         "rtpmux name=mux ! srtsink name=srtsink",
+            options.video_source != NULL ? options.video_source : DEFAULT_VIDEO_SOURCE,
+            sender.encoder->encoder);
+    /* *INDENT-ON* */
+
+    bin = gst_parse_bin_from_description(description, FALSE, error);
+
+    if (bin == NULL)
+        return NULL;
+
+    s = g_new0(Sender, 1);
+    s->id = sender.senders->len;
+    s->bin = (GstElement *) gst_object_ref_sink(bin);
+    s->metasrc = gst_bin_get_by_name(GST_BIN(bin), "metasrc");
+    s->srtsink = gst_bin_get_by_name(GST_BIN(bin), "srtsink");
+
+    name = g_strdup_printf("sender%u", s->id);
+    gst_object_set_name(GST_OBJECT(bin), name);
+
+    s->encoder = gst_bin_get_by_name(GST_BIN(bin), "encoder");
+    s->feedback = INVALID_SOCKET;
+    s->bitrate = options.bitrate;
+    configure_video_encoder(s->encoder, sender.encoder);
+
+    epad = gst_element_get_static_pad(s->encoder, "sink");
+    gst_pad_add_probe(epad, GST_PAD_PROBE_TYPE_BUFFER, _encoder_probe_cb, s,
+        NULL);
+
+    g_object_set(s->srtsink, "uri", uri, "streamid", streamid,
+        "latency", app.srt_latency, NULL);
+
+    if (options.feedback_port > 0)
+        start_feedback(s);
+
+    g_ptr_array_add(sender.senders, s);
+
+    return s;
+}
+
+static GstElement*
+build_send_pipeline(const gchar* uri, const gchar* streamid, GError** error)
+{
+    g_autoptr(GstElement) pipeline = NULL;
+    g_autoptr(GstBus) bus = NULL;
+    Sender* s = NULL;
+
+    pipeline = gst_pipeline_new("sender");
+
+    bus = gst_element_get_bus(pipeline);
+    gst_bus_add_watch(bus, _bus_watch, NULL);
+
+    s = build_sender(uri, streamid, error);
+
+    if (s == NULL)
+        goto error;
+
+    gst_bin_add(GST_BIN(pipeline), s->bin);
+
+    return (GstElement *) g_steal_pointer(&pipeline);
+
+error:
+    return NULL;
+}
+
+static void
+print_latency_report(void)
+{
+    guint i;
+
+    guint count;
+    gdouble p50, p99;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+
+        if (get_latency_percentiles(stream, &count, &p50, &p99))
+            g_print("stream %u latency: p50 %.1f ms, p99 %.1f ms (%u samples)\n",
+                stream->id, p50, p99, count);
+    }
+}
+
+/**
+ * Section: Trace report
+ *
+ * --trace-report turns on the latency tracer for pipeline and per-element
+ * latency and takes its records out of the debug log instead of printing
+ * them. Per element it sums the time each buffer spent from sink pad to
+ * source pad, and per source/sink pair the time through the whole
+ * pipeline; the record count doubles as throughput in buffers. Tracer
+ * records carry element names only, so names that repeat across streams
+ * such as 'q' are told apart by element ID.
+ */
+
+typedef struct
+{
+    gchar* name;
+
+    /* Since the last periodic summary, and since start */
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint64 total_count;
+    guint64 total_sum;
+    guint64 total_max;
+} TraceStats;
+
+static struct
+{
+    GMutex lock;
+    GHashTable* stats;
+    gint64 last_report;
+} tracer;
+
+static void
+trace_stats_free(gpointer data)
+{
+    TraceStats* stats = (TraceStats *) data;
+
+    g_free(stats->name);
+    g_free(stats);
+}
+
+static void
+add_trace_record(const gchar* key, const gchar* name, guint64 time)
+{
+    TraceStats* stats = NULL;
+
+    if (key == NULL)
+        return;
+
+    g_mutex_lock(&tracer.lock);
+
+    stats = (TraceStats *) g_hash_table_lookup(tracer.stats, key);
+    if (stats == NULL) {
+        stats = g_new0(TraceStats, 1);
+        stats->name = g_strdup(name);
+        g_hash_table_insert(tracer.stats, g_strdup(key), stats);
+    }
+
+    stats->count++;
+    stats->sum += time;
+    stats->max = MAX(stats->max, time);
+    stats->total_count++;
+    stats->total_sum += time;
+    stats->total_max = MAX(stats->total_max, time);
+
+    g_mutex_unlock(&tracer.lock);
+}
+
+static void
+handle_trace_record(const GstStructure* record)
+{
+    guint64 time = 0;
+
+    if (!gst_structure_get_uint64(record, "time", &time))
+        return;
+
+    if (gst_structure_has_name(record, "element-latency")) {
+        add_trace_record(gst_structure_get_string(record, "element-id"),
+            gst_structure_get_string(record, "element"), time);
+    }
+    else if (gst_structure_has_name(record, "latency")) {
+        g_autofree gchar* key = NULL;
+        g_autofree gchar* name = NULL;
+
+        key = g_strdup_printf("%s-%s",
+            gst_structure_get_string(record, "src-element-id"),
+            gst_structure_get_string(record, "sink-element-id"));
+        name = g_strdup_printf("%s -> %s",
+            gst_structure_get_string(record, "src-element"),
+            gst_structure_get_string(record, "sink-element"));
+
+        add_trace_record(key, name, time);
+    }
+}
+
+static void
+_trace_log_cb(GstDebugCategory* category, GstDebugLevel level,
+    const gchar* file, const gchar* function, gint line, GObject* object,
+    GstDebugMessage* message, gpointer user_data)
+{
+    GstStructure* record = NULL;
+
+    if (g_strcmp0(gst_debug_category_get_name(category), "GST_TRACER") == 0) {
+        record = gst_structure_from_string(gst_debug_message_get(message), NULL);
+
+        if (record != NULL && (gst_structure_has_name(record, "latency")
+                || gst_structure_has_name(record, "element-latency"))) {
+            handle_trace_record(record);
+            gst_structure_free(record);
+            return;
+        }
+
+        if (record != NULL)
+            gst_structure_free(record);
+    }
+
+    /* Everything else still goes where GST_DEBUG sends it */
+    gst_debug_log_default(category, level, file, function, line, object,
+        message, NULL);
+}
+
+static gint
+_compare_trace_stats(gconstpointer a, gconstpointer b)
+{
+    const TraceStats* sa = *(const TraceStats **) a;
+    const TraceStats* sb = *(const TraceStats **) b;
+
+    return g_strcmp0(sa->name, sb->name);
+}
+
+static void
+print_trace_report(gboolean total)
+{
+    g_autoptr(GPtrArray) sorted = g_ptr_array_new();
+    gint64 now = g_get_monotonic_time();
+    gdouble seconds;
+    GHashTableIter iter;
+    gpointer value;
+    guint i;
+
+    g_mutex_lock(&tracer.lock);
+
+    seconds = (now - tracer.last_report) / (gdouble) G_USEC_PER_SEC;
+    tracer.last_report = now;
+
+    g_hash_table_iter_init(&iter, tracer.stats);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        g_ptr_array_add(sorted, value);
+    g_ptr_array_sort(sorted, _compare_trace_stats);
+
+    g_print("trace report (%s):\n", total ? "total" : "last interval");
+
+    for (i = 0; i < sorted->len; i++) {
+        TraceStats* stats = (TraceStats *) g_ptr_array_index(sorted, i);
+        guint64 count = total ? stats->total_count : stats->count;
+        guint64 sum = total ? stats->total_sum : stats->sum;
+        guint64 max = total ? stats->total_max : stats->max;
+
+        if (count == 0)
+            continue;
+
+        /* *INDENT-OFF* */
+        if (total)
+            g_print("  %-40s %8" G_GUINT64_FORMAT " buffers, avg %7.3f ms, max %7.3f ms\n",
+                stats->name, count,
+                (gdouble) sum / count / GST_MSECOND,
+                (gdouble) max / GST_MSECOND);
+        else
+            g_print("  %-40s %8.1f buffers/s, avg %7.3f ms, max %7.3f ms\n",
+                stats->name, count / MAX(seconds, 1.0),
+                (gdouble) sum / count / GST_MSECOND,
+                (gdouble) max / GST_MSECOND);
+        /* *INDENT-ON* */
+
+        stats->count = stats->sum = stats->max = 0;
+    }
+
+    g_mutex_unlock(&tracer.lock);
+}
+
+static gboolean
+_trace_report_cb(gpointer user_data)
+{
+    print_trace_report(FALSE);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+prepare_trace_report(void)
+{
+    /* Read by gst_init(); an explicit GST_TRACERS wins */
+    g_setenv("GST_TRACERS", "latency(flags=pipeline+element)", FALSE);
+}
+
+static void
+start_trace_report(void)
+{
+    g_mutex_init(&tracer.lock);
+    tracer.stats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+        trace_stats_free);
+    tracer.last_report = g_get_monotonic_time();
+
+    gst_debug_set_threshold_for_name("GST_TRACER", GST_LEVEL_TRACE);
+    gst_debug_remove_log_function(gst_debug_log_default);
+    gst_debug_add_log_function(_trace_log_cb, NULL, NULL);
+
+    g_timeout_add_seconds(TRACE_REPORT_INTERVAL, _trace_report_cb, NULL);
+}
+
+static void
+stop_trace_report(void)
+{
+    print_trace_report(TRUE);
+
+    gst_debug_remove_log_function(_trace_log_cb);
+    gst_debug_add_log_function(gst_debug_log_default, NULL, NULL);
+
+    g_hash_table_unref(tracer.stats);
+    g_mutex_clear(&tracer.lock);
+}
+
+/**
+ * Section: Threads
+ *
+ * Every queue starts a streaming thread, which announces itself with a
+ * STREAM_STATUS message from inside that thread. The sync handler uses it
+ * to pin the thread to the next core and, on Windows, to register it with
+ * MMCSS; the threads feeding sinks get the higher MMCSS priority. Threads
+ * are told apart by the name of the element that owns them, anything not
+ * named here is 'other'.
+ */
+
+#ifdef G_OS_WIN32
+static GPrivate mmcss_handle = G_PRIVATE_INIT(NULL);
+#endif
+
+static const gchar*
+get_thread_role(GstElement* owner)
+{
+    const gchar* name = GST_ELEMENT_NAME(owner);
+
+    if (g_strcmp0(name, "srtsrc") == 0 || g_str_has_prefix(name, "path"))
+        return "receive";
+    if (g_strcmp0(name, "srcq") == 0)
+        return "demux";
+    if (g_strcmp0(name, "q") == 0)
+        return "branch";
+    if (g_strcmp0(name, "decodeq") == 0)
+        return "decode";
+    if (g_strcmp0(name, "renderq") == 0 || g_strcmp0(name, "compositor") == 0)
+        return "render";
+    if (g_strcmp0(name, "recq") == 0)
+        return "record";
+    if (g_str_has_prefix(name, "relayq"))
+        return "relay";
+
+    return "other";
+}
+
+static void
+pin_current_thread(guint cpu)
+{
+#ifdef G_OS_WIN32
+    GROUP_AFFINITY affinity;
+    DWORD count = 0;
+
+    /* The mask has one bit per processor of the thread's own group, at most
+     * 64, while cpu counts the processors of all groups */
+    if (GetThreadGroupAffinity(GetCurrentThread(), &affinity))
+        count = GetActiveProcessorCount(affinity.Group);
+    if (count == 0 || count > sizeof(DWORD_PTR) * 8)
+        count = sizeof(DWORD_PTR) * 8;
+
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << (cpu % count));
+#elif defined(__linux__)
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+static void
+enter_mmcss(const gchar* role)
+{
+#ifdef G_OS_WIN32
+    DWORD index = 0;
+    HANDLE handle = AvSetMmThreadCharacteristicsW(L"Playback", &index);
+
+    if (handle == NULL)
+        return;
+
+    /* Without a render queue the branch thread is the one that renders */
+    if (g_strcmp0(role, "render") == 0
+        || (g_strcmp0(role, "branch") == 0 && !options.render_thread))
+        AvSetMmThreadPriority(handle, AVRT_PRIORITY_HIGH);
+
+    g_private_set(&mmcss_handle, handle);
+#endif
+}
+
+static void
+leave_mmcss(void)
+{
+#ifdef G_OS_WIN32
+    HANDLE handle = g_private_get(&mmcss_handle);
+
+    if (handle == NULL)
+        return;
+
+    AvRevertMmThreadCharacteristics(handle);
+    g_private_set(&mmcss_handle, NULL);
+#endif
+}
+
+static GstBusSyncReply
+_stream_status_cb(GstBus* bus, GstMessage* message, gpointer user_data)
+{
+    GstStreamStatusType type;
+    GstElement* owner = NULL;
+    const gchar* role = NULL;
+
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_STREAM_STATUS)
+        return GST_BUS_PASS;
+
+    gst_message_parse_stream_status(message, &type, &owner);
+
+    if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+        if (options.mmcss)
+            leave_mmcss();
+        return GST_BUS_PASS;
+    }
+
+    if (type != GST_STREAM_STATUS_TYPE_ENTER)
+        return GST_BUS_PASS;
+
+    role = get_thread_role(owner);
+
+    if (options.pin_threads) {
+        guint cpu = (guint) g_atomic_int_add(&app.next_cpu, 1) %
+            g_get_num_processors();
+
+        pin_current_thread(cpu);
+        g_print("%s thread of %s on cpu %u\n", role,
+            GST_OBJECT_NAME(GST_OBJECT_PARENT(owner)), cpu);
+    }
+
+    if (options.mmcss)
+        enter_mmcss(role);
+
+    return GST_BUS_PASS;
+}
+
+static GstBusSyncReply
+_sync_bus_cb(GstBus* bus, GstMessage* message, gpointer user_data)
+{
+    /* Has to happen in the posting thread, see Section: Relay */
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR)
+        mark_relay_failed(GST_MESSAGE_SRC(message));
+
+    /* Copies a recording sink bin forwards, see Section: Recording */
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ELEMENT
+        && gst_message_has_name(message, "GstBinForwarded")) {
+        note_recorder_eos(message);
+        gst_message_unref(message);
+
+        return GST_BUS_DROP;
+    }
+
+    if (options.pin_threads || options.mmcss)
+        return _stream_status_cb(bus, message, user_data);
+
+    return GST_BUS_PASS;
+}
+
+static GstElement*
+build_recv_pipeline(GPtrArray* uris, const gchar* streamid, GError** error)
+{
+    g_autoptr(GstElement) pipeline = NULL;
+    g_autoptr(GstBus) bus = NULL;
+
+    guint i;
+
+    /* All streams share one pipeline, one clock and one bus */
+    pipeline = gst_pipeline_new("receiver");
+
+    bus = gst_element_get_bus(pipeline);
+    gst_bus_add_watch(bus, _bus_watch, NULL);
+
+    if (options.multiview && !add_multiview(pipeline, error))
+        goto error;
+
+    gst_bus_set_sync_handler(bus, _sync_bus_cb, NULL, NULL);
+
+    /* One stream fed by all of them */
+    if (options.bond) {
+        Stream* stream = build_bond_stream(uris, streamid, error);
+
+        if (stream == NULL)
+            goto error;
+
+        gst_bin_add(GST_BIN(pipeline), stream->bin);
+        g_ptr_array_add(app.streams, stream);
+
+        return (GstElement *) g_steal_pointer(&pipeline);
+    }
+
+    for (i = 0; uris != NULL && i < uris->len; i++) {
+        const gchar* uri = (const gchar *) g_ptr_array_index(uris, i);
+        Stream* stream = build_recv_stream(uri, streamid, error);
+
+        if (stream == NULL)
+            goto error;
+
+        gst_bin_add(GST_BIN(pipeline), stream->bin);
+        g_ptr_array_add(app.streams, stream);
+    }
+
+    return (GstElement *) g_steal_pointer(&pipeline);
+
+error:
+    return NULL;
+}
+
+/**
+ * Section: Loopback
+ *
+ * --loopback N runs N senders and N receivers in one pipeline over
+ * localhost. With --loss, every sender goes through a UDP relay that drops
+ * that share of datagrams in both directions, so SRT has to recover data
+ * packets as well as lost ACKs and NAKs. The receivers start first, the
+ * senders are added once the listeners are up.
+ */
+
+typedef struct
+{
+    /* Bound to the relay port, talks to the sender */
+    UdpSocket front;
+    /* Connected to the receiver */
+    UdpSocket back;
+
+    struct sockaddr_in peer;
+    gboolean has_peer;
+} Relay;
+
+static struct
+{
+    GArray* relays;
+    GThread* thread;
+    gint running;
+    GRand* rand;
+
+    guint64 forwarded;
+    guint64 dropped;
+
+    gint64 started;
+    gint64 cpu_started;
+} loopback;
+
+static gint64
+get_process_cpu_time(void)
+{
+#ifdef G_OS_WIN32
+    FILETIME creation, exit, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+
+    return (gint64) ((k.QuadPart + u.QuadPart) / 10);
+#else
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+        return 0;
+
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+}
+
+static UdpSocket
+open_relay_socket(gint bind_port, gint connect_port)
+{
+    UdpSocket sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in sa;
+
+    if (sock == INVALID_SOCKET)
+        return INVALID_SOCKET;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sa.sin_port = htons(bind_port);
+    if (bind(sock, (struct sockaddr *) &sa, sizeof(sa)) != 0)
+        goto error;
+
+    sa.sin_port = htons(connect_port);
+    if (connect_port > 0
+        && connect(sock, (struct sockaddr *) &sa, sizeof(sa)) != 0)
+        goto error;
+
+    return sock;
+
+error:
+    close_udp_socket(sock);
+    return INVALID_SOCKET;
+}
+
+static gboolean
+drop_datagram(void)
+{
+    if (g_rand_double(loopback.rand) * 100 < options.loss) {
+        loopback.dropped++;
+        return TRUE;
+    }
+
+    loopback.forwarded++;
+    return FALSE;
+}
+
+static gpointer
+relay_thread_func(gpointer data)
+{
+    gchar buf[2048];
+    guint i;
+
+    while (g_atomic_int_get(&loopback.running)) {
+        struct timeval tv = { 0, 100 * 1000 };
+        UdpSocket max = 0;
+        fd_set set;
+
+        FD_ZERO(&set);
+        for (i = 0; i < loopback.relays->len; i++) {
+            Relay* relay = &g_array_index(loopback.relays, Relay, i);
+
+            FD_SET(relay->front, &set);
+            FD_SET(relay->back, &set);
+            max = MAX(max, MAX(relay->front, relay->back));
+        }
+
+        /* Wakes up now and then to check 'running' */
+        if (select((int) max + 1, &set, NULL, NULL, &tv) <= 0)
+            continue;
+
+        for (i = 0; i < loopback.relays->len; i++) {
+            Relay* relay = &g_array_index(loopback.relays, Relay, i);
+            socklen_t len = sizeof(relay->peer);
+            int n;
+
+            if (FD_ISSET(relay->front, &set)) {
+                n = recvfrom(relay->front, buf, sizeof(buf), 0,
+                    (struct sockaddr *) &relay->peer, &len);
+                relay->has_peer = n > 0 || relay->has_peer;
+
+                if (n > 0 && !drop_datagram())
+                    send(relay->back, buf, n, 0);
+            }
+
+            /* Fails with ECONNREFUSED until the receiver listens; ignored */
+            if (FD_ISSET(relay->back, &set)) {
+                n = recv(relay->back, buf, sizeof(buf), 0);
+
+                if (n > 0 && relay->has_peer && !drop_datagram())
+                    sendto(relay->front, buf, n, 0,
+                        (struct sockaddr *) &relay->peer, sizeof(relay->peer));
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static GstElement*
+build_loopback_pipeline(gint count, GError** error)
+{
+    g_autoptr(GstElement) pipeline = NULL;
+    g_autoptr(GstBus) bus = NULL;
+
+    gint i;
+
+    pipeline = gst_pipeline_new("loopback");
+
+    bus = gst_element_get_bus(pipeline);
+    gst_bus_add_watch(bus, _bus_watch, NULL);
+
+    if (options.multiview && !add_multiview(pipeline, error))
+        goto error;
+
+    gst_bus_set_sync_handler(bus, _sync_bus_cb, NULL, NULL);
+
+    for (i = 0; i < count; i++) {
+        g_autofree gchar* uri =
+            g_strdup_printf("srt://:%d?mode=listener", LOOPBACK_PORT + i);
+        Stream* stream = build_recv_stream(uri, NULL, error);
+
+        if (stream == NULL)
+            goto error;
+
+        gst_bin_add(GST_BIN(pipeline), stream->bin);
+        g_ptr_array_add(app.streams, stream);
+    }
+
+    return (GstElement *) g_steal_pointer(&pipeline);
+
+error:
+    return NULL;
+}
+
 static gboolean
-_parse_rest_arg_cb(const gchar* option_name, const gchar* value,
-    gpointer data, GError** error)
+start_loopback(gint count, GError** error)
 {
-    if (options.uri != NULL) {
-        g_printerr("URI has already been set.\n");
-        return FALSE;
+    gint i;
+
+    /* WSAStartup() on Windows */
+    srt_startup();
+
+    loopback.relays = g_array_new(FALSE, FALSE, sizeof(Relay));
+    loopback.rand = g_rand_new();
+
+    for (i = 0; i < count; i++) {
+        g_autofree gchar* uri = NULL;
+        gint port = LOOPBACK_PORT + i;
+        Sender* s = NULL;
+
+        if (options.loss > 0) {
+            Relay relay = { INVALID_SOCKET, INVALID_SOCKET };
+
+            relay.front = open_relay_socket(LOOPBACK_RELAY_PORT + i, 0);
+            relay.back = open_relay_socket(0, port);
+
+            if (relay.front == INVALID_SOCKET || relay.back == INVALID_SOCKET) {
+                g_set_error(error, GST_RESOURCE_ERROR,
+                    GST_RESOURCE_ERROR_OPEN_READ,
+                    "Failed to open relay on port %d", LOOPBACK_RELAY_PORT + i);
+                if (relay.front != INVALID_SOCKET)
+                    close_udp_socket(relay.front);
+                if (relay.back != INVALID_SOCKET)
+                    close_udp_socket(relay.back);
+                return FALSE;
+            }
+
+            g_array_append_val(loopback.relays, relay);
+            port = LOOPBACK_RELAY_PORT + i;
+        }
+
+        uri = g_strdup_printf("srt://127.0.0.1:%d", port);
+        s = build_sender(uri, NULL, error);
+
+        if (s == NULL)
+            return FALSE;
+
+        gst_bin_add(GST_BIN(app.pipeline), s->bin);
+        gst_element_sync_state_with_parent(s->bin);
     }
 
-    if (!g_str_has_prefix(value, "srt://")) {
-        g_printerr("Invalid SRT uri: %s\n", value);
-        return FALSE;
+    if (loopback.relays->len > 0) {
+        g_atomic_int_set(&loopback.running, TRUE);
+        loopback.thread = g_thread_new("loopback-relay", relay_thread_func, NULL);
     }
 
-    options.uri = g_strdup(value);
+    loopback.started = g_get_monotonic_time();
+    loopback.cpu_started = get_process_cpu_time();
+
+    g_print("loopback: %d streams at %d kbit/s, %.1f%% loss\n", count,
+        options.bitrate, options.loss);
 
     return TRUE;
 }
 
-static gchar*
-build_streamid(const gchar* u, const gchar* r)
+static void
+print_loopback_report(void)
 {
-    g_autofree gchar* streamid = NULL;
+    gdouble seconds =
+        (g_get_monotonic_time() - loopback.started) / (gdouble) G_USEC_PER_SEC;
+    gdouble cores =
+        (get_process_cpu_time() - loopback.cpu_started) / (gdouble) G_USEC_PER_SEC;
+    guint i;
 
-    g_autofree gchar* u_tag = NULL;
-    g_autofree gchar* r_tag = NULL;
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+        GstStructure* stats = get_stream_stats(stream);
+        gint64 lost = 0, retransmitted = 0, dropped = 0;
+        guint count = 0;
+        gdouble p50 = 0, p99 = 0;
 
-    if (u != NULL)
-        u_tag = g_strdup_printf("u=%s", u);
-    if (r != NULL)
-        r_tag = g_strdup_printf("r=%s", r);
+        if (stats != NULL) {
+            lost = get_stats_int(stats, "packets-received-lost");
+            retransmitted = get_stats_int(stats, "packets-received-retransmitted");
+            dropped = get_stats_int(stats, "packets-received-dropped");
+            gst_structure_free(stats);
+        }
 
-    if (u || r) {
+        get_latency_percentiles(stream, &count, &p50, &p99);
 
         /* *INDENT-OFF* */
-        streamid = g_strconcat("#!::",
-            u_tag != NULL ? u_tag : "",
-            u && r ? "," : "",
-            r_tag != NULL ? r_tag : "",
-            NULL);
+        g_print("loopback stream %u: latency p50 %.1f ms, p99 %.1f ms, "
+            "%" G_GINT64_FORMAT " lost, %" G_GINT64_FORMAT " retransmitted, %"
+            G_GINT64_FORMAT " dropped, %.1f%% recovered\n",
+            stream->id, p50, p99, lost, retransmitted, dropped,
+            lost > 0 ? (lost - MIN(dropped, lost)) * 100.0 / lost : 100.0);
         /* *INDENT-ON* */
-
     }
 
-    return (gchar *) g_steal_pointer(&streamid);
+    if (seconds <= 0 || cores <= 0 || app.streams->len == 0)
+        return;
+
+    /* Senders included, so this is a lower bound for a receive-only host */
+    cores /= seconds;
+    g_print("loopback: %.2f cores for %u streams, about %.1f streams per core\n",
+        cores, app.streams->len, app.streams->len / cores);
 }
 
-static gboolean
-_bus_watch(GstBus* bus, GstMessage* message, gpointer user_data)
+static void
+stop_loopback(void)
 {
-    switch (message->type) {
-    case GST_MESSAGE_EOS:
-    case GST_MESSAGE_ERROR:
-        g_printerr("Terminated\n");
-        g_main_loop_quit(app.loop);
-        break;
-    default:
-        break;
+    guint i;
+
+    if (loopback.thread != NULL) {
+        g_atomic_int_set(&loopback.running, FALSE);
+        g_thread_join(loopback.thread);
+
+        g_print("loopback relay: %" G_GUINT64_FORMAT " forwarded, %"
+            G_GUINT64_FORMAT " dropped\n", loopback.forwarded,
+            loopback.dropped);
     }
 
-    return G_SOURCE_CONTINUE;
+    for (i = 0; i < loopback.relays->len; i++) {
+        Relay* relay = &g_array_index(loopback.relays, Relay, i);
+
+        close_udp_socket(relay->front);
+        close_udp_socket(relay->back);
+    }
+
+    g_array_unref(loopback.relays);
+    g_rand_free(loopback.rand);
+
+    srt_cleanup();
 }
 
-static GstCaps*
-_request_pt_map_cb(GstElement* demux, guint pt, gpointer user_data)
+/**
+ * Section: Control
+ *
+ * --control PORT takes one command per UDP datagram on localhost and answers
+ * each with one datagram, all from the main loop:
+ *
+ *   stats                 the --stats lines of every stream and sender
+ *   srt-latency MS        SRT latency, for connections made from now on
+ *   jitter-latency MS     latency of every jitterbuffer, right away
+ *   queue-time MS         limit of every queue in the receive path
+ *   branch NAME on|off    the 'render', 'record', 'metadata' or 'audio'
+ *                         valve of every sink bin
+ *
+ * e.g. echo "branch render off" | nc -u -w1 127.0.0.1 PORT
+ */
+
+typedef struct
 {
-    GstCaps* caps = NULL;
+    const gchar* name;
+    gboolean drop;
+    guint count;
+} BranchCommand;
 
-    if (pt == 96) {
-        caps =
-            gst_caps_from_string
-            ("application/x-rtp, encoding-name=(string)H264, media=(string)video, clock-rate=(int)90000");
-    }
-    else if (pt == 99) {
-        /* We are going to use '99' for 'text/x-raw'. */
-        caps =
-            gst_caps_from_string
-            ("application/x-rtp, encoding-name=(string)X-GST, media=(string)application, clock-rate=(int)90000");
-    }
-    else {
-        /* Must be handled as error status */
-        g_print("wrong! pt\n");
+static void
+foreach_stream_element(GstIteratorForeachFunction func, gpointer user_data)
+{
+    GHashTableIter iter;
+    gpointer sinkbin;
+    guint i;
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+        GstIterator* it = gst_bin_iterate_recurse(GST_BIN(stream->bin));
+
+        gst_iterator_foreach(it, func, user_data);
+        gst_iterator_free(it);
+
+        /* Sink bins whose payload type hasn't shown up yet */
+        g_hash_table_iter_init(&iter, stream->sinkbins);
+        while (g_hash_table_iter_next(&iter, NULL, &sinkbin)) {
+            if (GST_OBJECT_PARENT(sinkbin) != NULL)
+                continue;
+
+            it = gst_bin_iterate_recurse(GST_BIN(sinkbin));
+            gst_iterator_foreach(it, func, user_data);
+            gst_iterator_free(it);
+        }
     }
-    return caps;
 }
 
-static GstPadProbeReturn
-_link_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+static gboolean
+has_factory(GstElement* element, const gchar* name)
 {
-    GstElement* pipeline = (GstElement * ) user_data;
+    GstElementFactory* factory = gst_element_get_factory(element);
 
-    GstElement* sinkbin = NULL;
+    return factory != NULL
+        && g_strcmp0(gst_plugin_feature_get_name(factory), name) == 0;
+}
 
-    g_autoptr(GstElement) first = NULL;
-    /*
-      g_autoptr (GstPad) gpad = NULL;
-      g_autoptr (GstPad) qpad = NULL;
-    */
-    g_autoptr(GstPad) qpad = NULL;
-    GstPad* gpad = NULL;
+static void
+_set_jitter_latency_cb(const GValue* value, gpointer user_data)
+{
+    GstElement* element = GST_ELEMENT(g_value_get_object(value));
 
-    g_print("pad link probe : %s\n", GST_PAD_NAME(pad));
+    if (has_factory(element, "rtpjitterbuffer"))
+        g_object_set(element, "latency", (guint) app.jitter_latency, NULL);
+}
 
-    sinkbin =
-        gst_parse_launch
-        ("queue name=q ! rtph264depay ! h264parse ! decodebin ! autovideosink async=true",
-            NULL);
+static void
+_set_queue_time_cb(const GValue* value, gpointer user_data)
+{
+    GstElement* element = GST_ELEMENT(g_value_get_object(value));
+    guint64 time = *(guint64 *) user_data;
 
-    gst_bin_add(GST_BIN(pipeline), sinkbin);
+    /* The recording and relay queues keep limits of their own */
+    if (!has_factory(element, "queue")
+        || g_str_has_prefix(GST_ELEMENT_NAME(element), "rec")
+        || g_str_has_prefix(GST_ELEMENT_NAME(element), "relay"))
+        return;
 
-    first = gst_bin_get_by_name(GST_BIN(sinkbin), "q");
-    qpad = gst_element_get_static_pad(first, "sink");
+    g_object_set(element, "max-size-buffers", 0, "max-size-bytes", 0,
+        "max-size-time", time, NULL);
+}
 
-    gpad = gst_ghost_pad_new(NULL, qpad);
-    gst_element_add_pad(sinkbin, gpad);
+static GstPadProbeReturn
+_resume_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+    /* A branch that was off starts again with a keyframe */
+    if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info),
+            GST_BUFFER_FLAG_DELTA_UNIT))
+        return GST_PAD_PROBE_DROP;
 
+    return GST_PAD_PROBE_REMOVE;
+}
 
-    if (gst_pad_link(pad, gpad) != GST_PAD_LINK_OK) {
-        g_error("failed to link pad to gpad");
+static void
+_set_branch_cb(const GValue* value, gpointer user_data)
+{
+    GstElement* element = GST_ELEMENT(g_value_get_object(value));
+    BranchCommand* command = (BranchCommand *) user_data;
+    gboolean drop = FALSE;
+
+    if (!has_factory(element, "valve")
+        || g_strcmp0(GST_ELEMENT_NAME(element), command->name) != 0)
+        return;
+
+    g_object_get(element, "drop", &drop, NULL);
+    if (drop == command->drop)
+        return;
+
+    if (!command->drop) {
+        g_autoptr(GstPad) pad = gst_element_get_static_pad(element, "src");
+
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, _resume_probe_cb,
+            NULL, NULL);
     }
 
-    gst_pad_set_active(gpad, TRUE);
-    gst_element_sync_state_with_parent(sinkbin);
+    g_object_set(element, "drop", command->drop, NULL);
+    command->count++;
+}
 
-    g_print("linking done for video\n");
+static void
+set_srt_latency(gint latency)
+{
+    guint i, j;
 
-    return GST_PAD_PROBE_REMOVE;
+    app.srt_latency = latency;
+
+    if (options.listen_port > 0)
+        srt_setsockflag(listener.sock, SRTO_RCVLATENCY, &app.srt_latency,
+            sizeof(app.srt_latency));
+
+    for (i = 0; i < app.streams->len; i++) {
+        Stream* stream = (Stream *) g_ptr_array_index(app.streams, i);
+
+        for (j = 0; j < stream->paths->len; j++)
+            g_object_set(((BondPath *) g_ptr_array_index(stream->paths,
+                        j))->srtsrc, "latency", latency, NULL);
+
+        for (j = 0; j < stream->relays->len; j++)
+            g_object_set(((RelayOutput *) g_ptr_array_index(stream->relays,
+                        j))->srtsink, "latency", latency, NULL);
+
+        if (stream->paths->len == 0 && stream->streamid == NULL)
+            g_object_set(stream->srtsrc, "latency", latency, NULL);
+    }
 }
 
-static GstPadProbeReturn
-_link_gstdepay_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+static gchar*
+handle_control_command(gchar** argv)
 {
-    GstElement* pipeline =  (GstElement *)user_data;
-    GstElement* sinkbin = NULL;
+    guint argc = g_strv_length(argv);
+    gint64 value = -1;
 
-    g_autoptr(GstElement) first = NULL;
-    g_autoptr(GstPad) qpad = NULL;
-    GstPad* gpad = NULL;
-    /*
-      g_autoptr (GstPad) gpad = NULL;
-    */
+    g_autoptr(GError) error = NULL;
 
-    sinkbin =
-        gst_parse_launch
-        ("queue name=q ! rtpgstdepay name=depay ! identity dump=true ! fakesink sync=false",
-            NULL);
+    /* The whole argument, as a number in range, or nothing is applied */
+    if (argc == 2 && (g_strcmp0(argv[0], "srt-latency") == 0
+            || g_strcmp0(argv[0], "jitter-latency") == 0
+            || g_strcmp0(argv[0], "queue-time") == 0)
+        && !g_ascii_string_to_signed(argv[1], 10, 0, CONTROL_MAX_MS, &value,
+            &error))
+        return g_strdup_printf("error: %s: %s\n", argv[0], error->message);
 
-    gst_bin_add(GST_BIN(pipeline), sinkbin);
+    if (argc == 1 && g_strcmp0(argv[0], "stats") == 0) {
+        GString* report = g_string_new(NULL);
 
-    first = gst_bin_get_by_name(GST_BIN(sinkbin), "q");
-    qpad = gst_element_get_static_pad(first, "sink");
+        append_stats(report);
 
-    gst_element_sync_state_with_parent(sinkbin);
+        return g_string_free(report, FALSE);
+    }
 
-    gpad = gst_ghost_pad_new(NULL, qpad);
-    gst_element_add_pad(sinkbin, gpad);
+    if (g_strcmp0(argv[0], "srt-latency") == 0 && value >= 0) {
+        set_srt_latency((gint) value);
 
-    gst_pad_set_active(gpad, TRUE);
-    gst_pad_link(pad, gpad);
+        return g_strdup_printf("ok: srt latency %d ms for new connections\n",
+            app.srt_latency);
+    }
 
-    return GST_PAD_PROBE_REMOVE;
-}
+    if (g_strcmp0(argv[0], "jitter-latency") == 0 && value >= 0) {
+        /* rtpjitterbuffer can't be put in afterwards */
+        if (app.jitter_latency == 0)
+            return g_strdup("error: started without a jitterbuffer\n");
 
+        app.jitter_latency = MAX((gint) value, 1);
+        update_jitterbuffer_description();
+        foreach_stream_element(_set_jitter_latency_cb, NULL);
 
-static void
-_new_payload_type_cb(GstElement* element, guint pt, GstPad* pad,
-    GstElement* user_data)
-{
-    GstElement* pipeline = user_data;
+        return g_strdup_printf("ok: jitterbuffer latency %d ms\n",
+            app.jitter_latency);
+    }
+
+    if (g_strcmp0(argv[0], "queue-time") == 0 && value >= 0) {
+        guint64 time = (guint64) value * GST_MSECOND;
+
+        /* With every other limit off, 0 would make the queues unbounded */
+        if (value == 0)
+            return g_strdup("error: queue-time must be at least 1 ms\n");
 
-    g_print("new payload type pt: %d\n", pt);
+        /* Sink bins and streams added from now on get it as well */
+        update_queue_description(time);
+        foreach_stream_element(_set_queue_time_cb, &time);
 
-    if (pt == 96) {
-        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_IDLE, _link_cb, pipeline, NULL);
+        return g_strdup_printf("ok: queues hold up to %" G_GINT64_FORMAT
+            " ms\n", value);
     }
-    else if (pt == 99) {
-        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_IDLE,
-            _link_gstdepay_cb, pipeline, NULL);
+
+    if (argc == 3 && g_strcmp0(argv[0], "branch") == 0
+        && (g_strcmp0(argv[2], "on") == 0 || g_strcmp0(argv[2], "off") == 0)) {
+        BranchCommand command = { argv[1], g_strcmp0(argv[2], "off") == 0, 0 };
+        guint i;
+
+        foreach_stream_element(_set_branch_cb, &command);
+
+        /* Don't wait out the rest of the GOP for the keyframe to resume at */
+        if (!command.drop && command.count > 0) {
+            for (i = 0; i < app.streams->len; i++)
+                wait_for_keyframe((Stream *) g_ptr_array_index(app.streams, i),
+                    "branch resumed");
+        }
+
+        return g_strdup_printf("ok: %u '%s' branches %s\n", command.count,
+            argv[1], argv[2]);
     }
+
+    return g_strdup("error: expected stats, srt-latency MS, jitter-latency MS,"
+        " queue-time MS or branch render|record|metadata|audio on|off\n");
 }
 
-static GstElement*
-build_recv_pipeline(const gchar* uri, const gchar* streamid, GError** error)
+static gboolean
+_control_cb(GIOChannel* channel, GIOCondition condition, gpointer user_data)
 {
-    g_autoptr(GstElement) pipeline = NULL;
-    g_autoptr(GstElement) rtpdemux = NULL;
-    g_autoptr(GstElement) srtsrc = NULL;
+    gchar buf[256];
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    g_auto(GStrv) argv = NULL;
+    g_autofree gchar* reply = NULL;
+    int n;
 
-    g_autoptr(GstBus) bus = NULL;
+    n = recvfrom(app.control, buf, sizeof(buf) - 1, 0,
+        (struct sockaddr *) &peer, &len);
+    if (n <= 0)
+        return G_SOURCE_CONTINUE;
 
-    pipeline = gst_parse_launch("srtsrc name=srtsrc ! queue ! rtpptdemux name=rtpdemux ", error);
+    buf[n] = '\0';
+    argv = g_strsplit(g_strstrip(buf), " ", 0);
 
-    if (pipeline == NULL)
-        goto error;
+    if (argv[0] == NULL)
+        return G_SOURCE_CONTINUE;
 
-    bus = gst_element_get_bus(pipeline);
-    gst_bus_add_watch(bus, _bus_watch, NULL);
+    g_print("control: %s\n", buf);
+    reply = handle_control_command(argv);
 
-    srtsrc = gst_bin_get_by_name(GST_BIN(pipeline), "srtsrc");
-    rtpdemux = gst_bin_get_by_name(GST_BIN(pipeline), "rtpdemux");
+    sendto(app.control, reply, (int) strlen(reply), 0,
+        (struct sockaddr *) &peer, len);
 
-    g_object_set(srtsrc, "uri", uri, "streamid", streamid, NULL);
+    return G_SOURCE_CONTINUE;
+}
 
-    g_signal_connect(rtpdemux, "new-payload-type", G_CALLBACK(_new_payload_type_cb), pipeline);
-    g_signal_connect(rtpdemux, "request-pt-map", G_CALLBACK(_request_pt_map_cb), NULL);
+static gboolean
+start_control(gint port, GError** error)
+{
+    GIOChannel* channel = NULL;
+    struct sockaddr_in sa;
 
-    return (GstElement *) g_steal_pointer(&pipeline);
+    app.control = socket(AF_INET, SOCK_DGRAM, 0);
+    if (app.control == INVALID_SOCKET) {
+        g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_OPEN_READ,
+            "Failed to create the control socket");
+        return FALSE;
+    }
 
-error:
-    return NULL;
+    /* Nothing here is authenticated, so only local clients */
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = htons(port);
+
+    if (bind(app.control, (struct sockaddr *) &sa, sizeof(sa)) != 0) {
+        g_set_error(error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_OPEN_READ,
+            "Failed to bind the control socket to port %d", port);
+        close_udp_socket(app.control);
+        app.control = INVALID_SOCKET;
+        return FALSE;
+    }
+
+#ifdef G_OS_WIN32
+    channel = g_io_channel_win32_new_socket((gint) app.control);
+#else
+    channel = g_io_channel_unix_new(app.control);
+#endif
+    g_io_add_watch(channel, G_IO_IN, _control_cb, NULL);
+    g_io_channel_unref(channel);
+
+    g_print("control: listening on 127.0.0.1:%d\n", port);
+
+    return TRUE;
 }
 
 int
@@ -286,19 +6259,122 @@ main(int argc, char* argv[])
     g_autofree gchar* streamid = NULL;
 
     gboolean help = FALSE;
+    guint i;
 
     GOptionEntry entries[] = {
       {"user", 'u', 0, G_OPTION_ARG_STRING, &options.user, "Authorization Name",
           NULL},
       {"resource", 'r', 0, G_OPTION_ARG_STRING, &options.resource,
           "Resource Name", NULL},
+      {"decoder", 'd', 0, G_OPTION_ARG_CALLBACK, _parse_decoder_arg_cb,
+          "Video Decoder (" VIDEO_DECODER_NAMES ")", "NAME"},
+      {"listen", 'l', 0, G_OPTION_ARG_INT, &options.listen_port,
+          "Accept callers on this port, one stream per stream ID", "PORT"},
+      {"latency", 0, 0, G_OPTION_ARG_INT, &options.latency,
+          "Total receive latency, split between SRT and the jitterbuffer", "MS"},
+      {"srt-latency", 0, 0, G_OPTION_ARG_INT, &options.srt_latency,
+          "SRT receive latency (default: 125)", "MS"},
+      {"jitter-latency", 0, 0, G_OPTION_ARG_INT, &options.jitter_latency,
+          "Add a jitterbuffer per payload type with this latency", "MS"},
+      {"drop-on-late", 0, 0, G_OPTION_ARG_NONE, &options.drop_on_late,
+          "Drop packets that arrive after the jitterbuffer latency", NULL},
+      {"low-latency", 0, 0, G_OPTION_ARG_NONE, &options.low_latency,
+          "Leaky queues, SRT latency of 40 ms and no render delay", NULL},
+      {"stats", 0, 0, G_OPTION_ARG_FILENAME, &options.stats,
+          "Write SRT statistics as JSON lines to FILE ('-' for stdout)", "FILE"},
+      {"stats-interval", 0, 0, G_OPTION_ARG_INT, &options.stats_interval,
+          "Seconds between statistics samples (default: 1)", "SEC"},
+      {"metadata-buffers", 0, 0, G_OPTION_ARG_INT, &options.metadata_buffers,
+          "Metadata samples queued for the application before dropping (default: 64)", "N"},
+      {"dump-metadata", 0, 0, G_OPTION_ARG_NONE, &options.dump_metadata,
+          "Print a line for every metadata sample", NULL},
+      {"send", 's', 0, G_OPTION_ARG_NONE, &options.send,
+          "Send to the given URI instead of receiving", NULL},
+      {"encoder", 'e', 0, G_OPTION_ARG_CALLBACK, _parse_encoder_arg_cb,
+          "Video Encoder (auto, nvcodec, qsv, mf, x264)", "NAME"},
+      {"video-source", 0, 0, G_OPTION_ARG_STRING, &options.video_source,
+          "Video source pipeline description for --send", "DESC"},
+      {"bitrate", 'b', 0, G_OPTION_ARG_INT, &options.bitrate,
+          "Video bitrate for --send (default: 4000)", "KBPS"},
+      {"gop", 0, 0, G_OPTION_ARG_INT, &options.gop,
+          "Keyframe interval for --send (default: 60)", "FRAMES"},
+      {"payload-type", 'p', 0, G_OPTION_ARG_CALLBACK, _parse_payload_type_arg_cb,
+          "Map a payload type to h264, h265, av1, opus, aac, klv, x-gst, caps or none (default: 96=h264 99=x-gst)",
+          "PT=FORMAT"},
+      {"decode-thread", 0, 0, G_OPTION_ARG_NONE, &options.decode_thread,
+          "Decode on a thread of its own, behind another queue", NULL},
+      {"render-thread", 0, 0, G_OPTION_ARG_NONE, &options.render_thread,
+          "Render on a thread of its own, behind another queue", NULL},
+      {"pin-threads", 0, 0, G_OPTION_ARG_NONE, &options.pin_threads,
+          "Pin each streaming thread to the next CPU core", NULL},
+      {"mmcss", 0, 0, G_OPTION_ARG_NONE, &options.mmcss,
+          "Register streaming threads with MMCSS (Windows only)", NULL},
+      {"instrument", 0, 0, G_OPTION_ARG_NONE, &options.instrument,
+          "Print buffers, bytes, allocations and pool hits per element every second",
+          NULL},
+      {"bench", 0, G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK,
+          _parse_bench_arg_cb,
+          "Headless run into fakesink, reporting fps, Mbps and CPU per stream (decode, transport)",
+          "MODE"},
+      {"loopback", 0, 0, G_OPTION_ARG_INT, &options.loopback,
+          "Send N streams to N receivers over localhost and report latency, recovery and load",
+          "N"},
+      {"loss", 0, 0, G_OPTION_ARG_DOUBLE, &options.loss,
+          "Drop this share of datagrams between the --loopback senders and receivers",
+          "PERCENT"},
+      {"record", 0, 0, G_OPTION_ARG_FILENAME, &options.record,
+          "Record the compressed video into segments in DIR, without decoding",
+          "DIR"},
+      {"record-format", 0, 0, G_OPTION_ARG_STRING, &options.record_format,
+          "Segment format for --record: ts or mp4 (fragmented, default: ts)",
+          "FORMAT"},
+      {"segment-time", 0, 0, G_OPTION_ARG_INT, &options.segment_time,
+          "Seconds per --record segment (default: 60)", "SEC"},
+      {"relay", 0, 0, G_OPTION_ARG_STRING_ARRAY, &options.relay,
+          "Forward every input unparsed to this SRT URI (repeatable)", "URI"},
+      {"multiview", 0, 0, G_OPTION_ARG_NONE, &options.multiview,
+          "Show all video streams tiled in one window, composited on the GPU",
+          NULL},
+      {"fast-start", 0, 0, G_OPTION_ARG_NONE, &options.fast_start,
+          "Skip the plugin scan using a registry cache and preload only the plugins the payload types need",
+          NULL},
+      {"registry", 0, 0, G_OPTION_ARG_FILENAME, &options.registry,
+          "Registry cache for --fast-start (default: in the user cache directory)",
+          "FILE"},
+      {"overload", 0, 0, G_OPTION_ARG_STRING, &options.overload,
+          "How far video may degrade when decoding falls behind: none, drop (non-reference frames) or keyframes (default: none)",
+          "POLICY"},
+      {"control", 0, 0, G_OPTION_ARG_INT, &options.control_port,
+          "Take stats, srt-latency, jitter-latency, queue-time and branch commands on this localhost UDP port",
+          "PORT"},
+      {"bond", 0, 0, G_OPTION_ARG_NONE, &options.bond,
+          "Take all URIs as paths of one feed and drop the duplicates", NULL},
+      {"feedback-port", 0, 0, G_OPTION_ARG_INT, &options.feedback_port,
+          "UDP port on the sender for keyframe requests and congestion reports from receivers (default: off)",
+          "PORT"},
+      {"abr", 0, 0, G_OPTION_ARG_NONE, &options.abr,
+          "Adapt the --send bitrate to the --feedback-port congestion reports, up to --bitrate",
+          NULL},
+      {"duration", 0, 0, G_OPTION_ARG_INT, &options.duration,
+          "Stop after this many seconds and print the reports", "SEC"},
+      {"trace-report", 0, 0, G_OPTION_ARG_NONE, &options.trace_report,
+          "Summarize latency tracer output per element, every 10 s and at exit",
+          NULL},
+      {"reconnect", 0, 0, G_OPTION_ARG_NONE, &options.reconnect,
+          "Restart a dropped SRT connection without tearing down the decoder", NULL},
       {"help", 'h', 0, G_OPTION_ARG_NONE, &help, "Show Help", NULL},
       {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_CALLBACK, _parse_rest_arg_cb, NULL,
           NULL},
       {NULL}
     };
 
-    context = g_option_context_new("uri");
+    startup.start = g_get_monotonic_time();
+
+    /* Told apart from an explicit 0 by configure_latency() */
+    options.srt_latency = -1;
+    options.jitter_latency = -1;
+
+    context = g_option_context_new("uri [uri...]");
     g_option_context_set_help_enabled(context, FALSE);
     g_option_context_add_main_entries(context, entries, NULL);
 
@@ -308,22 +6384,138 @@ main(int argc, char* argv[])
         return -1;
     }
 
-    if (help || options.uri == NULL) {
+    if (help || (options.uris == NULL && options.listen_port <= 0
+            && options.loopback <= 0)) {
         g_autofree gchar* text = g_option_context_get_help(context, FALSE, NULL);
         g_printerr("%s\n", text);
         return -1;
     }
 
+    if (options.send && (options.uris == NULL || options.uris->len != 1)) {
+        g_printerr("--send takes exactly one URI\n");
+        return -1;
+    }
+
+    if (options.loopback > 0 && (options.send || options.uris != NULL)) {
+        g_printerr("--loopback takes no URI and can not be combined with --send\n");
+        return -1;
+    }
+
+    if (options.bond && (options.send || options.uris == NULL
+            || options.uris->len < 2)) {
+        g_printerr("--bond takes two or more URIs and can not be combined with --send\n");
+        return -1;
+    }
+
+    /* Benchmarks replace every sink, the compositor's too */
+    if (options.bench != NULL)
+        options.multiview = FALSE;
+
+    if (options.abr && options.feedback_port <= 0) {
+        g_printerr("--abr needs --feedback-port\n");
+        return -1;
+    }
+
+    if (options.metadata_buffers <= 0)
+        options.metadata_buffers = DEFAULT_METADATA_BUFFERS;
+    if (options.bitrate <= 0)
+        options.bitrate = DEFAULT_BITRATE;
+    if (options.gop <= 0)
+        options.gop = DEFAULT_GOP;
+    if (options.segment_time <= 0)
+        options.segment_time = DEFAULT_SEGMENT_TIME;
+
+    for (options.overload_policy = OVERLOAD_NONE; options.overload != NULL
+        && options.overload_policy < N_OVERLOAD_LEVELS; options.overload_policy++) {
+        if (g_strcmp0(options.overload, overload_levels[options.overload_policy]) == 0)
+            break;
+    }
+
+    if (options.overload_policy == N_OVERLOAD_LEVELS) {
+        g_printerr("Invalid overload policy: %s\n", options.overload);
+        return -1;
+    }
+
+    if (options.record_format != NULL
+        && g_strcmp0(options.record_format, "ts") != 0
+        && g_strcmp0(options.record_format, "mp4") != 0) {
+        g_printerr("Invalid record format: %s\n", options.record_format);
+        return -1;
+    }
+
+    if (options.record != NULL && g_mkdir_with_parents(options.record, 0755) != 0) {
+        g_printerr("Failed to create %s\n", options.record);
+        return -1;
+    }
+
+    if (!configure_latency(&error)) {
+        g_printerr("%s\n", error->message);
+
+        return -1;
+    }
+
+    if (options.trace_report)
+        prepare_trace_report();
+    if (options.fast_start)
+        prepare_fast_start();
+
     gst_init(&argc, &argv);
+    mark_startup(STARTUP_INIT, g_get_monotonic_time());
+
+    if (options.trace_report)
+        start_trace_report();
+
+    if (!options.send && !configure_payload_types(&error)) {
+        g_printerr("%s\n", error->message);
+
+        return -1;
+    }
 
     app.loop = g_main_loop_new(NULL, FALSE);
+    app.streams = g_ptr_array_new_with_free_func((GDestroyNotify) stream_free);
+    sender.senders = g_ptr_array_new_with_free_func((GDestroyNotify) sender_free);
+    g_mutex_init(&app.instruments_lock);
+    app.instruments = g_ptr_array_new_with_free_func(element_stats_unref);
+
+    /* Also brings up Winsock for the keyframe request sockets */
+    app.feedback = INVALID_SOCKET;
+    app.control = INVALID_SOCKET;
+    if (options.feedback_port > 0 || options.control_port > 0)
+        srt_startup();
+
+    if (options.feedback_port > 0) {
+        if (!options.send) {
+            app.feedback = socket(AF_INET, SOCK_DGRAM, 0);
+            g_timeout_add_seconds(FEEDBACK_REPORT_INTERVAL, _feedback_report_cb,
+                NULL);
+        }
+    }
 
     /* Stream ID */
     streamid = build_streamid(options.user, options.resource);
 
     /* Build GStreamer Pipeline */
-    app.pipeline =
-        build_recv_pipeline(options.uri, streamid, &error);
+    if (options.send) {
+        app.pipeline =
+            build_send_pipeline((const gchar *) g_ptr_array_index(options.uris, 0),
+                streamid, &error);
+    }
+    else {
+        /* Video Decoder; a relay never decodes */
+        if (options.relay == NULL)
+            select_decoders(options.decoder);
+
+        if (options.fast_start) {
+            preload_plugins();
+            mark_startup(STARTUP_PRELOAD, g_get_monotonic_time());
+        }
+
+        if (options.loopback > 0)
+            app.pipeline = build_loopback_pipeline(options.loopback, &error);
+        else
+            app.pipeline =
+                build_recv_pipeline(options.uris, streamid, &error);
+    }
 
     if (app.pipeline == NULL) {
         g_printerr("%s\n", error->message);
@@ -331,14 +6523,103 @@ main(int argc, char* argv[])
         return -1;
     }
 
+    mark_startup(STARTUP_BUILD, g_get_monotonic_time());
+
     gst_element_set_state(app.pipeline, GST_STATE_PLAYING);
 
+    if (options.loopback > 0 && !start_loopback(options.loopback, &error)) {
+        g_printerr("%s\n", error->message);
+
+        return -1;
+    }
+
+    if (options.listen_port > 0 && !start_listener(options.listen_port, &error)) {
+        g_printerr("%s\n", error->message);
+
+        return -1;
+    }
+
+    if (options.control_port > 0 && !start_control(options.control_port, &error)) {
+        g_printerr("%s\n", error->message);
+
+        return -1;
+    }
+
+    if (options.stats != NULL) {
+        app.stats = g_strcmp0(options.stats, "-") == 0 ? stdout :
+            g_fopen(options.stats, "a");
+
+        if (app.stats == NULL) {
+            g_printerr("Failed to open %s\n", options.stats);
+
+            return -1;
+        }
+
+        g_timeout_add_seconds(MAX(options.stats_interval, 1), _stats_cb, NULL);
+    }
+
+    if (options.instrument)
+        g_timeout_add_seconds(1, _instrument_report_cb, NULL);
+
+    if (options.duration > 0)
+        g_timeout_add_seconds(options.duration, _duration_cb, NULL);
+
     g_main_loop_run(app.loop);
 
+    /* Needs the SRT sockets, which go away in NULL */
+    if (options.loopback > 0)
+        print_loopback_report();
+
+    if (options.listen_port > 0)
+        stop_listener();
+
+    for (i = 0; i < app.streams->len; i++)
+        finalize_recordings((Stream *) g_ptr_array_index(app.streams, i));
+
     gst_element_set_state(app.pipeline, GST_STATE_NULL);
 
+    if (options.loopback > 0)
+        stop_loopback();
+
+    print_latency_report();
+
+    if (options.bench != NULL)
+        print_bench_report();
+
+    if (options.trace_report)
+        stop_trace_report();
+
+    g_ptr_array_unref(app.streams);
+    g_ptr_array_unref(app.instruments);
+    g_mutex_clear(&app.instruments_lock);
+    g_ptr_array_unref(sender.senders);
+    if (app.compositor != NULL)
+        gst_object_unref(app.compositor);
     gst_object_unref(app.pipeline);
+
+    if (app.feedback != INVALID_SOCKET)
+        close_udp_socket(app.feedback);
+    if (app.control != INVALID_SOCKET)
+        close_udp_socket(app.control);
+    if (options.feedback_port > 0 || options.control_port > 0)
+        srt_cleanup();
+
     g_main_loop_unref(app.loop);
+    g_free(app.jitterbuffer);
+    g_free(app.queue);
+    g_free(app.decode_queue);
+    g_free(app.render_queue);
+
+    for (i = 0; i < RTP_PAYLOAD_TYPES; i++) {
+        if (app.pt_caps[i] != NULL)
+            gst_caps_unref(app.pt_caps[i]);
+        g_free(options.payload_types[i]);
+    }
+
+    if (app.stats != NULL && app.stats != stdout)
+        fclose(app.stats);
+    if (options.uris != NULL)
+        g_ptr_array_unref(options.uris);
 
     return 0;
 }
\ No newline at end of file